@@ -0,0 +1,220 @@
+/*
+  Distort effect for Buzztrax
+  Copyright (C) 2020 David Beswick
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/*
+  Measures the speed of the distortion kernels, without GStreamer.
+
+  Every available kernel is run over a matrix of buffer sizes, oversampling factors, curve settings and input
+  signals. Results are written to stdout as tab-separated values with a header line, one line per combination, so
+  that runs can be compared with standard tools. Progress and notes go to stderr.
+
+  Usage: kernel [seconds per case]
+*/
+
+#include "config.h"
+#include "src/adaa.h"
+#include "src/curve_table.h"
+#include "src/kernel.h"
+#include "src/oversampler.h"
+#include "src/polynomial.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Realtime multiples are given for this rate.
+#define BASE_RATE 44100
+
+typedef struct {
+  const char* name;
+  const BtEdbKernelSet* set;
+  // Only set for table kernels.
+  BtEdbInterp interp;
+  // Only set for ADAA kernels.
+  guint adaa_order;
+  gboolean polynomial;
+} Kernel;
+
+typedef struct {
+  const Kernel* kernel;
+  const BtEdbDistortParams* params;
+  BtEdbDistortKernel func;
+  BtEdbCurveTable* table;
+  BtEdbAdaaTable* adaa_table;
+  BtEdbAdaaState adaa_state;
+  BtEdbPolynomial* polynomial;
+  BtEdbGainRamp gains;
+} Context;
+
+typedef enum {
+  SIGNAL_SINE,
+  SIGNAL_NOISE,
+  SIGNAL_SILENCE,
+  N_SIGNALS
+} Signal;
+
+static const char* const signal_names[N_SIGNALS] = { "sine", "noise", "silence" };
+
+static const guint buffer_sizes[] = { 64, 256, 1024, 4096 };
+static const guint factors[] = { 1, 2, 4, 8 };
+
+static gdouble now(void) {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+static void fill(Signal signal, gfloat* data, guint nsamples) {
+  for (guint i = 0; i < nsamples; ++i) {
+    switch (signal) {
+    case SIGNAL_SINE: data[i] = 0.8f * sinf(2 * G_PI * 440 * i / BASE_RATE); break;
+    case SIGNAL_NOISE: data[i] = 2.0f * rand() / RAND_MAX - 1; break;
+    default: data[i] = 0; break;
+    }
+  }
+}
+
+static void run(gpointer user_data, gfloat* data, guint nsamples) {
+  Context* const context = (Context*)user_data;
+  if (context->table)
+    btedb_curve_table_process(context->table, data, nsamples);
+  else if (context->adaa_table)
+    btedb_adaa_process(context->adaa_table, context->kernel->adaa_order, &context->adaa_state, data, 1, nsamples);
+  else if (context->polynomial)
+    btedb_polynomial_process(context->polynomial, data, nsamples);
+  else
+    context->func(context->params, &context->gains, data, nsamples);
+}
+
+/*
+  Returns the time taken per input sample, in seconds. With a factor above 1, the internal oversampler is included,
+  and the kernel processes "factor" times as many samples.
+ */
+static gdouble measure(Context* context, guint buffer_size, guint factor, Signal signal, gdouble seconds) {
+  gfloat* const input = g_new(gfloat, buffer_size);
+  gfloat* const data = g_new(gfloat, buffer_size * factor);
+  BtEdbOversampler* const oversampler =
+    factor > 1 ? btedb_oversampler_new(factor, 1, BTEDB_OVERSAMPLER_QUALITY_HIGH) : NULL;
+
+  fill(signal, input, buffer_size);
+
+  guint64 nsamples = 0;
+  const gdouble start = now();
+  gdouble elapsed;
+
+  do {
+    // Enough iterations to make the cost of reading the clock negligible.
+    for (guint i = 0; i < 64; ++i) {
+      memcpy(data, input, buffer_size * sizeof(gfloat));
+      if (oversampler)
+        btedb_oversampler_process(oversampler, 0, data, 1, buffer_size, run, context);
+      else
+        run(context, data, buffer_size);
+    }
+    nsamples += 64 * buffer_size;
+    elapsed = now() - start;
+  } while (elapsed < seconds);
+
+  if (oversampler)
+    btedb_oversampler_free(oversampler);
+  g_free(data);
+  g_free(input);
+
+  return elapsed / nsamples;
+}
+
+int main(int argc, char** argv) {
+  const gdouble seconds = argc > 1 ? atof(argv[1]) : 0.02;
+
+  btedb_kernel_init();
+  fprintf(stderr, "default kernel: %s\n", btedb_kernel_name());
+
+  GArray* const kernels = g_array_new(FALSE, FALSE, sizeof(Kernel));
+  g_array_append_val(kernels, ((Kernel){ "scalar", &btedb_kernels_scalar }));
+#if HAVE_X86_KERNELS
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("sse2"))
+    g_array_append_val(kernels, ((Kernel){ "sse2", &btedb_kernels_sse2 }));
+  if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+    g_array_append_val(kernels, ((Kernel){ "avx2", &btedb_kernels_avx2 }));
+  if (__builtin_cpu_supports("avx512f"))
+    g_array_append_val(kernels, ((Kernel){ "avx512", &btedb_kernels_avx512 }));
+#endif
+  g_array_append_val(kernels, ((Kernel){ "table-linear", NULL, BTEDB_INTERP_LINEAR }));
+  g_array_append_val(kernels, ((Kernel){ "table-cubic", NULL, BTEDB_INTERP_CUBIC }));
+  g_array_append_val(kernels, ((Kernel){ "adaa1", NULL, 0, 1 }));
+  g_array_append_val(kernels, ((Kernel){ "adaa2", NULL, 0, 2 }));
+  g_array_append_val(kernels, ((Kernel){ "polynomial", NULL, 0, 0, TRUE }));
+
+  // The element's default settings, which use the constant shape regime, and a setting that needs the general one.
+  const struct {
+    const char* name;
+    BtEdbDistortParams params;
+  } shapes[] = {
+    { "const", { 20, 1, 1, 1, TRUE, 20, 1, 1, 1, 0 } },
+    { "general", { 20, 1, 3, 2, TRUE, 10, 0.5, 2, 0.5, -3 } }
+  };
+
+  printf("kernel\tshape\tsymmetric\tsignal\tbuffer\toversample\tns_per_sample\tsamples_per_sec\trealtime\n");
+
+  for (guint k = 0; k < kernels->len; ++k) {
+    const Kernel* const kernel = &g_array_index(kernels, Kernel, k);
+    fprintf(stderr, "benchmarking %s\n", kernel->name);
+
+    for (guint s = 0; s < G_N_ELEMENTS(shapes); ++s) {
+      for (gint symmetric = 1; symmetric >= 0; --symmetric) {
+        BtEdbDistortParams params = shapes[s].params;
+        params.symmetric = symmetric;
+
+        Context context = { kernel, &params };
+        btedb_gain_ramp_init(&context.gains, &params);
+        if (kernel->set)
+          context.func = btedb_kernel_set_select(kernel->set, &params);
+        else if (kernel->adaa_order)
+          context.adaa_table = btedb_adaa_table_new(&params, 4096);
+        else if (kernel->polynomial)
+          context.polynomial = btedb_polynomial_new(&params);
+        else
+          context.table = btedb_curve_table_new(&params, 4096, kernel->interp);
+
+        for (Signal signal = 0; signal < N_SIGNALS; ++signal) {
+          for (guint b = 0; b < G_N_ELEMENTS(buffer_sizes); ++b) {
+            for (guint f = 0; f < G_N_ELEMENTS(factors); ++f) {
+              const gdouble t = measure(&context, buffer_sizes[b], factors[f], signal, seconds);
+              printf("%s\t%s\t%d\t%s\t%u\t%u\t%.3f\t%.0f\t%.1f\n",
+                     kernel->name, shapes[s].name, symmetric, signal_names[signal], buffer_sizes[b], factors[f],
+                     t * 1e9, 1 / t, 1 / (t * BASE_RATE));
+            }
+          }
+        }
+
+        if (context.table)
+          btedb_curve_table_unref(context.table);
+        if (context.adaa_table)
+          btedb_adaa_table_unref(context.adaa_table);
+        if (context.polynomial)
+          btedb_polynomial_unref(context.polynomial);
+      }
+    }
+  }
+
+  g_array_free(kernels, TRUE);
+  return 0;
+}
@@ -0,0 +1,350 @@
+/*
+  Distort effect for Buzztrax
+  Copyright (C) 2020 David Beswick
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/*
+  Measures how whole GStreamer pipelines of the effect scale, for capacity planning.
+
+  Each case builds a headless pipeline of N instances, either in series after one source:
+
+    audiotestsrc ! capsfilter ! bt_edb_distort ! ... ! bt_edb_distort ! fakesink sync=false
+
+  or in parallel, as N independent chains like the tracks of a song:
+
+    audiotestsrc ! capsfilter ! bt_edb_distort ! fakesink sync=false  (N times)
+
+  The number of instances, channels, buffer size, oversampler and oversampling factor are swept. For each case, the
+  time taken to build the pipeline and to preroll it (which includes caps negotiation and the first buffer), the
+  throughput while playing, CPU load and memory are measured. Results are written to stdout as tab-separated values
+  with a header line, one line per case. Progress and failures go to stderr.
+
+  Every case runs in a child process of its own, so that memory is measured from a clean start and filters shared
+  between instances aren't carried over from an earlier case. QoS is turned off, so every case runs at the quality
+  asked for.
+
+  Memory is the peak resident size, less that of the process before the pipeline was built, divided by the number of
+  instances. It includes each instance's share of the sources and sinks. "growth_kb" is the change in resident size
+  between preroll and the end; with a long run time, it shows memory that builds up during playback.
+
+  Usage: pipeline [seconds of audio per case] [plugin path]
+
+  The plugin is loaded from ".libs/libbt_edb_distort.so" by default, which is where libtool leaves it in the build
+  directory.
+*/
+
+#include "config.h"
+#include "src/debug.h"
+
+#include <gst/gst.h>
+#include <gst/audio/audio-format.h>
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define RATE 44100
+
+typedef enum {
+  TOPOLOGY_SERIES,
+  TOPOLOGY_PARALLEL,
+  N_TOPOLOGIES
+} Topology;
+
+static const char* const topology_names[N_TOPOLOGIES] = { "series", "parallel" };
+
+static const guint instance_counts[] = { 1, 8, 32 };
+static const guint channel_counts[] = { 1, 2 };
+static const guint buffer_sizes[] = { 64, 256, 1024 };
+static const char* const oversamplers[] = { "audioresample", "internal" };
+static const guint factors[] = { 1, 2, 4, 8 };
+
+typedef struct {
+  Topology topology;
+  guint instances;
+  guint channels;
+  guint buffer;
+  const char* oversampler;
+  guint oversample;
+} Case;
+
+static gdouble now(void) {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+// The CPU time used by every thread of the process so far, in seconds.
+static gdouble cpu_time(void) {
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return usage.ru_utime.tv_sec + usage.ru_utime.tv_usec * 1e-6 + usage.ru_stime.tv_sec + usage.ru_stime.tv_usec * 1e-6;
+}
+
+// Reads a size in kB from /proc/self/status, such as "VmRSS" or "VmHWM", or returns 0 if it's not available.
+static guint64 status_kb(const char* field) {
+  FILE* const file = fopen("/proc/self/status", "r");
+  if (!file)
+    return 0;
+
+  const size_t len = strlen(field);
+  char line[256];
+  guint64 result = 0;
+
+  while (fgets(line, sizeof(line), file)) {
+    if (!strncmp(line, field, len) && line[len] == ':') {
+      result = g_ascii_strtoull(line + len + 1, NULL, 10);
+      break;
+    }
+  }
+
+  fclose(file);
+  return result;
+}
+
+static GstElement* make_element(const char* factory) {
+  GstElement* const element = gst_element_factory_make(factory, NULL);
+  if (!element)
+    fprintf(stderr, "couldn't create a \"%s\" element\n", factory);
+  return element;
+}
+
+static GstElement* make_source(const Case* c, guint num_buffers) {
+  GstElement* const src = make_element("audiotestsrc");
+  if (src)
+    g_object_set(src, "samplesperbuffer", (gint)c->buffer, "num-buffers", (gint)num_buffers, "volume", 0.5, NULL);
+  return src;
+}
+
+static GstElement* make_capsfilter(const Case* c) {
+  GstElement* const filter = make_element("capsfilter");
+  if (filter) {
+    GstCaps* const caps = gst_caps_new_simple(
+      "audio/x-raw",
+      "format", G_TYPE_STRING, GST_AUDIO_NE(F32),
+      "layout", G_TYPE_STRING, "interleaved",
+      "rate", G_TYPE_INT, RATE,
+      "channels", G_TYPE_INT, (gint)c->channels,
+      NULL);
+    g_object_set(filter, "caps", caps, NULL);
+    gst_caps_unref(caps);
+  }
+  return filter;
+}
+
+static GstElement* make_distort(const Case* c) {
+  GstElement* const distort = make_element(G_STRINGIFY(GST_MACHINE_NAME));
+  if (distort) {
+    g_object_set(distort, "oversample", c->oversample, "qos", FALSE, NULL);
+    gst_util_set_object_arg((GObject*)distort, "oversampler", c->oversampler);
+  }
+  return distort;
+}
+
+static GstElement* make_sink(void) {
+  GstElement* const sink = make_element("fakesink");
+  if (sink)
+    g_object_set(sink, "sync", FALSE, NULL);
+  return sink;
+}
+
+// Adds "element" to the pipeline and links it after "prev", if there is one. Takes ownership of "element".
+static gboolean add_linked(GstElement* pipeline, GstElement* prev, GstElement* element) {
+  if (!element)
+    return FALSE;
+
+  gst_bin_add((GstBin*)pipeline, element);
+
+  if (prev && !gst_element_link(prev, element)) {
+    fprintf(stderr, "couldn't link %s to %s\n", GST_ELEMENT_NAME(prev), GST_ELEMENT_NAME(element));
+    return FALSE;
+  }
+  return TRUE;
+}
+
+// Adds a source and its capsfilter, and returns the capsfilter, or NULL on failure.
+static GstElement* add_source(GstElement* pipeline, const Case* c, guint num_buffers) {
+  GstElement* const src = make_source(c, num_buffers);
+  if (!add_linked(pipeline, NULL, src))
+    return NULL;
+
+  GstElement* const filter = make_capsfilter(c);
+  return add_linked(pipeline, src, filter) ? filter : NULL;
+}
+
+static gboolean build(GstElement* pipeline, const Case* c, guint num_buffers) {
+  if (c->topology == TOPOLOGY_SERIES) {
+    GstElement* prev = add_source(pipeline, c, num_buffers);
+    if (!prev)
+      return FALSE;
+
+    for (guint i = 0; i < c->instances; ++i) {
+      GstElement* const distort = make_distort(c);
+      if (!add_linked(pipeline, prev, distort))
+        return FALSE;
+      prev = distort;
+    }
+
+    return add_linked(pipeline, prev, make_sink());
+  } else {
+    for (guint i = 0; i < c->instances; ++i) {
+      GstElement* const filter = add_source(pipeline, c, num_buffers);
+      if (!filter)
+        return FALSE;
+
+      GstElement* const distort = make_distort(c);
+      if (!add_linked(pipeline, filter, distort) || !add_linked(pipeline, distort, make_sink()))
+        return FALSE;
+    }
+    return TRUE;
+  }
+}
+
+// Waits for the pipeline to finish, and returns FALSE if it posted an error instead.
+static gboolean wait_eos(GstElement* pipeline) {
+  GstBus* const bus = gst_element_get_bus(pipeline);
+  GstMessage* const msg =
+    gst_bus_timed_pop_filtered(bus, GST_CLOCK_TIME_NONE, GST_MESSAGE_EOS | GST_MESSAGE_ERROR);
+  gboolean result = TRUE;
+
+  if (GST_MESSAGE_TYPE(msg) == GST_MESSAGE_ERROR) {
+    GError* error = NULL;
+    gst_message_parse_error(msg, &error, NULL);
+    fprintf(stderr, "pipeline error: %s\n", error->message);
+    g_error_free(error);
+    result = FALSE;
+  }
+
+  gst_message_unref(msg);
+  gst_object_unref(bus);
+  return result;
+}
+
+// Runs one case and prints its results. Called in a child process, which exits with the result.
+static gboolean run_case(const Case* c, gdouble seconds, const char* plugin_path) {
+  gst_init(NULL, NULL);
+
+  GError* error = NULL;
+  GstPlugin* const plugin = gst_plugin_load_file(plugin_path, &error);
+  if (!plugin) {
+    fprintf(stderr, "couldn't load %s: %s\n", plugin_path, error->message);
+    g_error_free(error);
+    return FALSE;
+  }
+  gst_object_unref(plugin);
+
+  const guint num_buffers = (guint)ceil(seconds * RATE / c->buffer);
+  const gdouble audio_seconds = (gdouble)num_buffers * c->buffer / RATE;
+  const guint64 base_kb = status_kb("VmRSS");
+  gboolean result = FALSE;
+
+  const gdouble start = now();
+
+  GstElement* const pipeline = gst_pipeline_new(NULL);
+  if (!build(pipeline, c, num_buffers))
+    goto done;
+
+  const gdouble built = now();
+
+  // Prerolling negotiates caps through every instance, and pushes the first buffer through to each sink.
+  if (gst_element_set_state(pipeline, GST_STATE_PAUSED) == GST_STATE_CHANGE_FAILURE ||
+      gst_element_get_state(pipeline, NULL, NULL, GST_CLOCK_TIME_NONE) == GST_STATE_CHANGE_FAILURE) {
+    fprintf(stderr, "pipeline failed to preroll\n");
+    goto done;
+  }
+
+  const gdouble prerolled = now();
+  const guint64 preroll_kb = status_kb("VmRSS");
+  const gdouble cpu_start = cpu_time();
+
+  if (gst_element_set_state(pipeline, GST_STATE_PLAYING) == GST_STATE_CHANGE_FAILURE || !wait_eos(pipeline))
+    goto done;
+
+  const gdouble wall = now() - prerolled;
+  const gdouble cpu = cpu_time() - cpu_start;
+  const guint64 end_kb = status_kb("VmRSS");
+  const guint64 peak_kb = status_kb("VmHWM");
+
+  // Every instance processes all of the audio, in series or in parallel.
+  const gdouble samples = audio_seconds * RATE * c->channels * c->instances;
+
+  printf("%s\t%u\t%u\t%u\t%s\t%u\t%.2f\t%.2f\t%.3f\t%.1f\t%.0f\t%.4f\t%.0f\t%" G_GINT64_FORMAT "\n",
+         topology_names[c->topology], c->instances, c->channels, c->buffer, c->oversampler, c->oversample,
+         (built - start) * 1e3, (prerolled - built) * 1e3, wall,
+         wall > 0 ? audio_seconds / wall : 0,
+         wall > 0 ? samples / wall : 0,
+         cpu / audio_seconds / c->instances,
+         peak_kb > base_kb ? (gdouble)(peak_kb - base_kb) / c->instances : 0,
+         (gint64)end_kb - (gint64)preroll_kb);
+  result = TRUE;
+
+done:
+  gst_element_set_state(pipeline, GST_STATE_NULL);
+  gst_object_unref(pipeline);
+  return result;
+}
+
+int main(int argc, char** argv) {
+  const gdouble seconds = argc > 1 ? atof(argv[1]) : 1.0;
+  const char* const plugin_path = argc > 2 ? argv[2] : ".libs/libbt_edb_distort.so";
+  guint failures = 0;
+
+  printf("topology\tinstances\tchannels\tbuffer\toversampler\toversample\tbuild_ms\tpreroll_ms\twall_seconds"
+         "\trealtime\tsamples_per_sec\tcpu_load_per_instance\tkb_per_instance\tgrowth_kb\n");
+
+  for (guint t = 0; t < N_TOPOLOGIES; ++t) {
+    for (guint n = 0; n < G_N_ELEMENTS(instance_counts); ++n) {
+      fprintf(stderr, "benchmarking %u instances in %s\n", instance_counts[n], topology_names[t]);
+
+      for (guint ch = 0; ch < G_N_ELEMENTS(channel_counts); ++ch) {
+        for (guint b = 0; b < G_N_ELEMENTS(buffer_sizes); ++b) {
+          for (guint o = 0; o < G_N_ELEMENTS(oversamplers); ++o) {
+            for (guint f = 0; f < G_N_ELEMENTS(factors); ++f) {
+              const Case c = {
+                t, instance_counts[n], channel_counts[ch], buffer_sizes[b], oversamplers[o], factors[f]
+              };
+
+              // The child's output goes to the same stdout, so anything buffered must be written first.
+              fflush(stdout);
+
+              const pid_t pid = fork();
+              if (pid == 0) {
+                const gboolean ok = run_case(&c, seconds, plugin_path);
+                fflush(stdout);
+                _exit(ok ? 0 : 1);
+              }
+
+              int status = 0;
+              if (pid < 0 || waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+                fprintf(stderr, "failed: %s, %u instances, %u channels, %u frames, %s, %ux\n",
+                        topology_names[t], c.instances, c.channels, c.buffer, c.oversampler, c.oversample);
+                ++failures;
+              }
+            }
+          }
+        }
+      }
+    }
+  }
+
+  return failures ? 1 : 0;
+}
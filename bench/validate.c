@@ -0,0 +1,494 @@
+/*
+  Distort effect for Buzztrax
+  Copyright (C) 2020 David Beswick
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/*
+  Checks the accuracy of every way of evaluating the distortion curve, so that faster kernels can't quietly change the
+  sound.
+
+  Two kinds of measurement are made, and written to stdout as tab-separated values:
+
+  * "static": the curve is evaluated over a grid of inputs for settings swept across the range of each property, and
+    compared with btedb_kernel_f64, which computes the curve in double precision. The largest error is reported,
+    relative to the postgain.
+  * "sine": sines at several frequencies are distorted at each oversampling factor, using the internal oversampler.
+    The level of the fundamental and the total harmonic distortion below 0.4 times the sample rate are compared with
+    those of the exact curve, and the energy of everything that isn't a harmonic (i.e. aliasing) is reported.
+
+  Each mode declares the errors it's allowed. Any that are exceeded are listed on stderr, and the exit status is 1.
+
+  Usage: validate
+*/
+
+#include "config.h"
+#include "src/adaa.h"
+#include "src/curve_table.h"
+#include "src/kernel.h"
+#include "src/oversampler.h"
+#include "src/polynomial.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define RATE 48000
+// FFT length for the sine tests. Test frequencies are whole numbers of bins, so every harmonic and alias is too.
+#define FFT_SIZE 4096
+// Harmonics are compared up to this fraction of the sample rate, where the oversampler's passband ends.
+#define COMPARE_BAND 0.4
+#define SINE_AMPLITUDE 0.5
+#define STATIC_POINTS 2048
+#define TABLE_SIZE 4096
+
+typedef enum {
+  MODE_KERNEL,
+  MODE_TABLE,
+  MODE_ADAA,
+  // As the element does it, with the exact curve wherever the polynomial isn't accurate enough.
+  MODE_POLYNOMIAL
+} ModeType;
+
+typedef struct {
+  const char* name;
+  ModeType type;
+  const BtEdbKernelSet* set;
+  BtEdbInterp interp;
+  guint adaa_order;
+
+  /*
+    Tolerances. "max_error" only applies to curves no steeper than "max_slope" (relative to the postgain). Steeper
+    curves are nearly steps, and interpolating a table of them is bound to be inaccurate near the step.
+  */
+  gdouble max_error;
+  gdouble max_slope;
+  // The most that the fundamental and THD may differ from the exact curve's, in dB.
+  gdouble max_fundamental_db;
+  gdouble max_thd_db;
+} Mode;
+
+typedef struct {
+  const Mode* mode;
+  const BtEdbDistortParams* params;
+  BtEdbDistortKernel kernel;
+  BtEdbGainRamp gains;
+  BtEdbCurveTable* table;
+  BtEdbAdaaTable* adaa_table;
+  BtEdbAdaaState adaa_state;
+  BtEdbPolynomial* polynomial;
+} Context;
+
+// Property values to sweep, from the ends and the middle of each range given in btedb_distort_class_init.
+static const gfloat db_pregains[] = { -144, -24, 0, 20, 48, 144 };
+static const gfloat shapes[] = { 0, 0.25, 1, 10 };
+static const gfloat shape_exps[] = { 0, 0.5, 1, 3, 10 };
+static const gfloat db_postgains[] = { -144, 0, 144 };
+
+static const guint factors[] = { 1, 2, 4, 8, 16, 32, 64 };
+// In FFT bins: about 105Hz, 996Hz, 5004Hz and 9996Hz.
+static const guint sine_bins[] = { 9, 85, 427, 853 };
+
+static guint failures;
+
+static void fail(const char* what, const char* mode, gdouble value, gdouble limit) {
+  fprintf(stderr, "FAIL: %s for %s is %g, over the limit of %g\n", what, mode, value, limit);
+  failures++;
+}
+
+static void context_init(Context* context, const Mode* mode, const BtEdbDistortParams* params) {
+  memset(context, 0, sizeof(*context));
+  context->mode = mode;
+  context->params = params;
+  btedb_gain_ramp_init(&context->gains, params);
+
+  switch (mode->type) {
+  case MODE_KERNEL:
+    context->kernel = btedb_kernel_set_select(mode->set, params);
+    break;
+  case MODE_TABLE:
+    context->table = btedb_curve_table_new(params, TABLE_SIZE, mode->interp);
+    break;
+  case MODE_ADAA:
+    context->adaa_table = btedb_adaa_table_new(params, TABLE_SIZE);
+    break;
+  case MODE_POLYNOMIAL:
+    context->polynomial = btedb_polynomial_new(params);
+    if (!btedb_polynomial_is_accurate(context->polynomial))
+      context->kernel = btedb_kernel_select(params);
+    break;
+  }
+}
+
+static void context_clear(Context* context) {
+  if (context->table)
+    btedb_curve_table_unref(context->table);
+  if (context->adaa_table)
+    btedb_adaa_table_unref(context->adaa_table);
+  if (context->polynomial)
+    btedb_polynomial_unref(context->polynomial);
+}
+
+static void run(gpointer user_data, gfloat* data, guint nsamples) {
+  Context* const context = (Context*)user_data;
+
+  switch (context->mode->type) {
+  case MODE_KERNEL:
+    context->kernel(context->params, &context->gains, data, nsamples);
+    break;
+  case MODE_TABLE:
+    btedb_curve_table_process(context->table, data, nsamples);
+    break;
+  case MODE_ADAA:
+    btedb_adaa_process(context->adaa_table, context->mode->adaa_order, &context->adaa_state, data, 1, nsamples);
+    break;
+  case MODE_POLYNOMIAL:
+    if (context->kernel)
+      context->kernel(context->params, &context->gains, data, nsamples);
+    else
+      btedb_polynomial_process(context->polynomial, data, nsamples);
+    break;
+  }
+}
+
+/*
+  The largest error over a grid of inputs from -2 to 2, plus zero and some very small values, relative to the
+  postgain. ADAA is given each input three times, so that its output settles to the value of the curve there.
+ */
+static gdouble static_error(const Mode* mode, const BtEdbDistortParams* params) {
+  static gfloat input[STATIC_POINTS + 5];
+  static gdouble expected[STATIC_POINTS + 5];
+  const guint n = G_N_ELEMENTS(input);
+
+  for (guint i = 0; i < STATIC_POINTS; ++i) {
+    input[i] = -2 + 4.0f * i / (STATIC_POINTS - 1);
+  }
+  input[STATIC_POINTS] = 0;
+  input[STATIC_POINTS + 1] = 1e-6f;
+  input[STATIC_POINTS + 2] = -1e-6f;
+  input[STATIC_POINTS + 3] = 1;
+  input[STATIC_POINTS + 4] = -1;
+
+  BtEdbGainRamp gains;
+  btedb_gain_ramp_init(&gains, params);
+  for (guint i = 0; i < n; ++i) {
+    expected[i] = input[i];
+  }
+  btedb_kernel_f64(params, &gains, expected, n);
+
+  Context context;
+  context_init(&context, mode, params);
+
+  gdouble result = 0;
+
+  if (mode->type == MODE_ADAA) {
+    for (guint i = 0; i < n; ++i) {
+      gfloat held[3] = { input[i], input[i], input[i] };
+      run(&context, held, 3);
+      result = MAX(result, fabs(held[2] - expected[i]));
+    }
+  } else {
+    gfloat* const output = g_new(gfloat, n);
+    memcpy(output, input, sizeof(input));
+    run(&context, output, n);
+    for (guint i = 0; i < n; ++i) {
+      result = MAX(result, fabs(output[i] - expected[i]));
+    }
+    g_free(output);
+  }
+
+  context_clear(&context);
+
+  return result / btedb_db_to_gain(params->db_postgain);
+}
+
+// The steepest part of the curve, relative to the postgain, found by computing it at many points.
+static gdouble curve_slope(const BtEdbDistortParams* params) {
+  const guint n = 65536;
+  gdouble* const y = g_new(gdouble, n + 1);
+
+  for (guint i = 0; i <= n; ++i) {
+    y[i] = -1 + 2.0 * i / n;
+  }
+  BtEdbGainRamp gains;
+  btedb_gain_ramp_init(&gains, params);
+  btedb_kernel_f64(params, &gains, y, n + 1);
+
+  gdouble result = 0;
+  for (guint i = 0; i < n; ++i) {
+    result = MAX(result, fabs(y[i + 1] - y[i]) * n / 2);
+  }
+
+  g_free(y);
+  return result / btedb_db_to_gain(params->db_postgain);
+}
+
+static void static_sweep(const Mode* mode) {
+  gdouble worst = 0;
+  gdouble worst_checked = 0;
+
+  const guint nshapes = G_N_ELEMENTS(db_pregains) * G_N_ELEMENTS(shapes) * G_N_ELEMENTS(shapes) *
+    G_N_ELEMENTS(shape_exps);
+
+  for (guint i = 0; i < nshapes; ++i) {
+    // Each asymmetric setting pairs one set of positive values with a different set of negative values.
+    for (gint symmetric = 1; symmetric >= 0; --symmetric) {
+      for (guint p = 0; p < G_N_ELEMENTS(db_postgains); ++p) {
+        guint pos = i;
+        guint neg = (i * 7 + 3) % nshapes;
+        BtEdbDistortParams params;
+
+        params.pos_shape_exp = shape_exps[pos % G_N_ELEMENTS(shape_exps)];
+        pos /= G_N_ELEMENTS(shape_exps);
+        params.pos_shape_b = shapes[pos % G_N_ELEMENTS(shapes)];
+        pos /= G_N_ELEMENTS(shapes);
+        params.pos_shape_a = shapes[pos % G_N_ELEMENTS(shapes)];
+        pos /= G_N_ELEMENTS(shapes);
+        params.pos_db_pregain = db_pregains[pos];
+
+        params.neg_shape_exp = shape_exps[neg % G_N_ELEMENTS(shape_exps)];
+        neg /= G_N_ELEMENTS(shape_exps);
+        params.neg_shape_b = shapes[neg % G_N_ELEMENTS(shapes)];
+        neg /= G_N_ELEMENTS(shapes);
+        params.neg_shape_a = shapes[neg % G_N_ELEMENTS(shapes)];
+        neg /= G_N_ELEMENTS(shapes);
+        params.neg_db_pregain = db_pregains[neg];
+
+        params.symmetric = symmetric;
+        params.db_postgain = db_postgains[p];
+
+        const gdouble error = static_error(mode, &params);
+        worst = MAX(worst, error);
+
+        if (curve_slope(&params) <= mode->max_slope)
+          worst_checked = MAX(worst_checked, error);
+      }
+    }
+  }
+
+  printf("static\t%s\t-\t-\t%.3g\t%.3g\t-\t-\t-\n", mode->name, worst, worst_checked);
+
+  if (worst_checked > mode->max_error)
+    fail("max error", mode->name, worst_checked, mode->max_error);
+}
+
+// An in-place radix-2 FFT of "n" complex values, interleaved real and imaginary.
+static void fft(gdouble* data, guint n) {
+  for (guint i = 1, j = 0; i < n; ++i) {
+    guint bit = n >> 1;
+    for (; j & bit; bit >>= 1)
+      j ^= bit;
+    j ^= bit;
+    if (i < j) {
+      gdouble t;
+      t = data[2*i]; data[2*i] = data[2*j]; data[2*j] = t;
+      t = data[2*i + 1]; data[2*i + 1] = data[2*j + 1]; data[2*j + 1] = t;
+    }
+  }
+
+  for (guint len = 2; len <= n; len <<= 1) {
+    const gdouble angle = -2 * G_PI / len;
+    for (guint i = 0; i < n; i += len) {
+      for (guint k = 0; k < len / 2; ++k) {
+        const gdouble wr = cos(angle * k), wi = sin(angle * k);
+        gdouble* const a = data + 2 * (i + k);
+        gdouble* const b = data + 2 * (i + k + len / 2);
+        const gdouble br = b[0] * wr - b[1] * wi;
+        const gdouble bi = b[0] * wi + b[1] * wr;
+        b[0] = a[0] - br; b[1] = a[1] - bi;
+        a[0] += br; a[1] += bi;
+      }
+    }
+  }
+}
+
+// The power in each bin from 0 to n/2 of "n" real samples.
+static void power_spectrum(const gdouble* samples, guint n, gdouble* power) {
+  gdouble* const data = g_new(gdouble, 2 * n);
+  for (guint i = 0; i < n; ++i) {
+    data[2*i] = samples[i];
+    data[2*i + 1] = 0;
+  }
+  fft(data, n);
+  for (guint i = 0; i <= n / 2; ++i) {
+    power[i] = data[2*i] * data[2*i] + data[2*i + 1] * data[2*i + 1];
+  }
+  g_free(data);
+}
+
+typedef struct {
+  gdouble fundamental;
+  gdouble harmonics;
+  gdouble alias;
+} SineResult;
+
+// Sorts the power of a sine at "bin" into the fundamental, harmonics below COMPARE_BAND, and everything else.
+static SineResult sine_analyse(const gdouble* power, guint bin) {
+  SineResult result = { power[bin], 0, 0 };
+  for (guint i = 1; i <= FFT_SIZE / 2; ++i) {
+    if (i % bin)
+      result.alias += power[i];
+    else if (i != bin && i < COMPARE_BAND * FFT_SIZE)
+      result.harmonics += power[i];
+  }
+  return result;
+}
+
+/*
+  The exact curve's spectrum, without aliasing: one period of the distorted sine is computed at a rate high enough for
+  all the harmonics that matter.
+ */
+static SineResult sine_reference(const BtEdbDistortParams* params, guint bin) {
+  gdouble* const samples = g_new(gdouble, FFT_SIZE);
+  gdouble* const power = g_new(gdouble, FFT_SIZE / 2 + 1);
+
+  for (guint i = 0; i < FFT_SIZE; ++i) {
+    samples[i] = SINE_AMPLITUDE * sin(2 * G_PI * i / FFT_SIZE);
+  }
+  BtEdbGainRamp gains;
+  btedb_gain_ramp_init(&gains, params);
+  btedb_kernel_f64(params, &gains, samples, FFT_SIZE);
+  power_spectrum(samples, FFT_SIZE, power);
+
+  // Harmonic h is in bin h here, and would be in bin h * "bin" at the test rate.
+  SineResult result = { power[1], 0, 0 };
+  for (guint h = 2; h * bin < COMPARE_BAND * FFT_SIZE; ++h) {
+    result.harmonics += power[h];
+  }
+
+  g_free(power);
+  g_free(samples);
+  return result;
+}
+
+static gdouble db(gdouble power_ratio) {
+  return 10 * log10(power_ratio);
+}
+
+static void sine_sweep(const Mode* mode, const BtEdbDistortParams* params, gdouble* exact_alias) {
+  for (guint f = 0; f < G_N_ELEMENTS(factors); ++f) {
+    const guint factor = factors[f];
+
+    for (guint b = 0; b < G_N_ELEMENTS(sine_bins); ++b) {
+      const guint bin = sine_bins[b];
+      // Enough to fill the oversampler's filters, and a whole number of periods so that the output is periodic.
+      const guint warmup = FFT_SIZE;
+      const guint n = warmup + FFT_SIZE;
+
+      gfloat* const data = g_new(gfloat, n);
+      for (guint i = 0; i < n; ++i) {
+        data[i] = SINE_AMPLITUDE * sin(2 * G_PI * (gdouble)bin * i / FFT_SIZE);
+      }
+
+      Context context;
+      context_init(&context, mode, params);
+      if (factor > 1) {
+        BtEdbOversampler* const oversampler = btedb_oversampler_new(factor, 1, BTEDB_OVERSAMPLER_QUALITY_HIGH);
+        btedb_oversampler_process(oversampler, 0, data, 1, n, run, &context);
+        btedb_oversampler_free(oversampler);
+      } else {
+        run(&context, data, n);
+      }
+      context_clear(&context);
+
+      gdouble* const samples = g_new(gdouble, FFT_SIZE);
+      gdouble* const power = g_new(gdouble, FFT_SIZE / 2 + 1);
+      for (guint i = 0; i < FFT_SIZE; ++i) {
+        samples[i] = data[warmup + i];
+      }
+      power_spectrum(samples, FFT_SIZE, power);
+
+      const SineResult measured = sine_analyse(power, bin);
+      const SineResult reference = sine_reference(params, bin);
+
+      const gdouble fundamental_db = db(measured.fundamental / reference.fundamental);
+      const gdouble alias_db = db(measured.alias / measured.fundamental);
+      const gboolean has_harmonics = reference.harmonics > 0;
+      const gdouble thd_db = has_harmonics ?
+        db((measured.harmonics / measured.fundamental) / (reference.harmonics / reference.fundamental)) : 0;
+
+      printf("sine\t%s\t%u\t%.0f\t-\t-\t%.2f\t", mode->name, factor, (gdouble)bin * RATE / FFT_SIZE, fundamental_db);
+      if (has_harmonics)
+        printf("%.2f", thd_db);
+      else
+        printf("-");
+      printf("\t%.1f\n", alias_db);
+
+      if (fabs(fundamental_db) > mode->max_fundamental_db)
+        fail("fundamental error (dB)", mode->name, fabs(fundamental_db), mode->max_fundamental_db);
+      if (fabs(thd_db) > mode->max_thd_db)
+        fail("THD error (dB)", mode->name, fabs(thd_db), mode->max_thd_db);
+
+      // ADAA is only worth using if it aliases less than the exact curve does.
+      const guint index = f * G_N_ELEMENTS(sine_bins) + b;
+      if (mode->type == MODE_KERNEL && mode->set == &btedb_kernels_scalar)
+        exact_alias[index] = alias_db;
+      else if (mode->type == MODE_ADAA && alias_db > exact_alias[index] + 1)
+        fail("aliasing compared to the exact curve (dB)", mode->name, alias_db - exact_alias[index], 1);
+
+      g_free(power);
+      g_free(samples);
+      g_free(data);
+    }
+  }
+}
+
+int main(void) {
+  btedb_kernel_init();
+
+  GArray* const modes = g_array_new(FALSE, FALSE, sizeof(Mode));
+  // The scalar kernel comes first, as the ADAA modes' aliasing is compared with it.
+  g_array_append_val(modes, ((Mode){ "scalar", MODE_KERNEL, &btedb_kernels_scalar, 0, 0, 2e-4, G_MAXDOUBLE, 0.01, 0.1 }));
+#if HAVE_X86_KERNELS
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("sse2"))
+    g_array_append_val(modes, ((Mode){ "sse2", MODE_KERNEL, &btedb_kernels_sse2, 0, 0, 2e-4, G_MAXDOUBLE, 0.01, 0.1 }));
+  if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+    g_array_append_val(modes, ((Mode){ "avx2", MODE_KERNEL, &btedb_kernels_avx2, 0, 0, 2e-4, G_MAXDOUBLE, 0.01, 0.1 }));
+  if (__builtin_cpu_supports("avx512f"))
+    g_array_append_val(modes, ((Mode){ "avx512", MODE_KERNEL, &btedb_kernels_avx512, 0, 0, 2e-4, G_MAXDOUBLE, 0.01, 0.1 }));
+#endif
+  g_array_append_val(modes, ((Mode){ "table-linear", MODE_TABLE, NULL, BTEDB_INTERP_LINEAR, 0, 5e-4, 100, 0.01, 0.1 }));
+  g_array_append_val(modes, ((Mode){ "table-cubic", MODE_TABLE, NULL, BTEDB_INTERP_CUBIC, 0, 5e-4, 100, 0.01, 0.1 }));
+  g_array_append_val(modes, ((Mode){ "adaa1", MODE_ADAA, NULL, 0, 1, 5e-4, 100, 1.5, 3 }));
+  g_array_append_val(modes, ((Mode){ "adaa2", MODE_ADAA, NULL, 0, 2, 5e-4, 100, 4, 6 }));
+  /*
+    Polynomials leave out harmonics below -60dB, which barely changes the THD, and may be off by up to their declared
+    tolerance.
+  */
+  g_array_append_val(
+    modes, ((Mode){ "polynomial", MODE_POLYNOMIAL, NULL, 0, 0, BTEDB_POLYNOMIAL_TOLERANCE, 100, 0.05, 0.5 }));
+
+  // The element's defaults.
+  const BtEdbDistortParams default_params = { 20, 1, 1, 1, TRUE, 20, 1, 1, 1, 0 };
+  gdouble exact_alias[G_N_ELEMENTS(factors) * G_N_ELEMENTS(sine_bins)];
+
+  printf("test\tmode\toversample\tfrequency\tmax_error\tmax_error_checked\tfundamental_db\tthd_db\talias_db\n");
+
+  for (guint m = 0; m < modes->len; ++m) {
+    const Mode* const mode = &g_array_index(modes, Mode, m);
+    fprintf(stderr, "validating %s\n", mode->name);
+    static_sweep(mode);
+    sine_sweep(mode, &default_params, exact_alias);
+  }
+
+  g_array_free(modes, TRUE);
+
+  if (failures)
+    fprintf(stderr, "%u checks failed\n", failures);
+
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,270 @@
+/*
+  Distort effect for Buzztrax
+  Copyright (C) 2020 David Beswick
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "config.h"
+#include "src/adaa.h"
+
+#include <float.h>
+#include <math.h>
+#include <string.h>
+
+/*
+  When consecutive inputs are closer than this, the divided differences lose too much precision, and the curve is
+  evaluated at their midpoint instead. The result is almost the same, as the curve is nearly linear over so short a
+  span.
+*/
+#define EPSILON_1 1e-5
+#define EPSILON_2 1e-3
+
+// For magnitudes over 1, the curve is sign * (1 - exp(-k * magnitude)) * postgain.
+typedef struct {
+  gdouble k;
+  gdouble exp_k;
+} Tail;
+
+struct _BtEdbAdaaTable {
+  gint refcount;
+
+  BtEdbDistortParams params;
+  guint size;
+
+  // Entry i is at x = i / scale - 1, so entry size - 1 is at zero.
+  guint n;
+  gdouble scale;
+  gdouble h;
+  gdouble postgain;
+  Tail pos;
+  Tail neg;
+
+  // The curve and its first and second antiderivatives, which are zero at x = 0.
+  gdouble* f0;
+  gdouble* f1;
+  gdouble* f2;
+};
+
+static void tail_init(Tail* tail, gfloat db_pregain, gfloat shape_b, gfloat shape_exp) {
+  const gdouble denom = pow(shape_b, shape_exp);
+  tail->k = denom > 0 ? btedb_db_to_gain(db_pregain) / denom : DBL_MAX;
+  tail->exp_k = exp(-tail->k);
+}
+
+BtEdbAdaaTable* btedb_adaa_table_new(const BtEdbDistortParams* params, guint size) {
+  g_assert(size >= 2);
+
+  const guint n = 2 * size - 1;
+  BtEdbAdaaTable* self = g_malloc(sizeof(BtEdbAdaaTable) + sizeof(gdouble) * n * 3);
+
+  self->refcount = 1;
+  self->params = *params;
+  self->size = size;
+  self->n = n;
+  self->scale = size - 1;
+  self->h = 1.0 / self->scale;
+  self->postgain = btedb_db_to_gain(params->db_postgain);
+  self->f0 = (gdouble*)(self + 1);
+  self->f1 = self->f0 + n;
+  self->f2 = self->f1 + n;
+
+  tail_init(&self->pos, params->pos_db_pregain, params->pos_shape_b, params->pos_shape_exp);
+  if (params->symmetric)
+    self->neg = self->pos;
+  else
+    tail_init(&self->neg, params->neg_db_pregain, params->neg_shape_b, params->neg_shape_exp);
+
+  // The curve is sampled at each entry and halfway between, for Simpson's rule.
+  BtEdbGainRamp gains;
+  btedb_gain_ramp_init(&gains, params);
+
+  gdouble* const mid = g_new(gdouble, n - 1);
+  for (guint i = 0; i < n; ++i) {
+    self->f0[i] = i * self->h - 1;
+  }
+  for (guint i = 0; i < n - 1; ++i) {
+    mid[i] = (i + 0.5) * self->h - 1;
+  }
+  btedb_kernel_f64(params, &gains, self->f0, n);
+  btedb_kernel_f64(params, &gains, mid, n - 1);
+
+  /*
+    Integration works outwards from zero. Over each interval, the first antiderivative is found with Simpson's rule,
+    and the second by integrating the cubic that matches the first antiderivative and its slope at each end.
+  */
+  const guint zero = size - 1;
+  const gdouble h = self->h;
+  self->f1[zero] = 0;
+  self->f2[zero] = 0;
+
+  for (guint i = zero; i < n - 1; ++i) {
+    self->f1[i + 1] = self->f1[i] + h / 6 * (self->f0[i] + 4 * mid[i] + self->f0[i + 1]);
+    self->f2[i + 1] =
+      self->f2[i] + h / 2 * (self->f1[i] + self->f1[i + 1]) + h * h / 12 * (self->f0[i] - self->f0[i + 1]);
+  }
+
+  for (guint i = zero; i > 0; --i) {
+    self->f1[i - 1] = self->f1[i] - h / 6 * (self->f0[i - 1] + 4 * mid[i - 1] + self->f0[i]);
+    self->f2[i - 1] =
+      self->f2[i] - h / 2 * (self->f1[i - 1] + self->f1[i]) - h * h / 12 * (self->f0[i - 1] - self->f0[i]);
+  }
+
+  g_free(mid);
+
+  return self;
+}
+
+BtEdbAdaaTable* btedb_adaa_table_ref(BtEdbAdaaTable* self) {
+  g_atomic_int_inc(&self->refcount);
+  return self;
+}
+
+void btedb_adaa_table_unref(BtEdbAdaaTable* self) {
+  if (g_atomic_int_dec_and_test(&self->refcount))
+    g_free(self);
+}
+
+gboolean btedb_adaa_table_matches(const BtEdbAdaaTable* self, const BtEdbDistortParams* params, guint size) {
+  return self->size == size && memcmp(&self->params, params, sizeof(*params)) == 0;
+}
+
+gdouble btedb_adaa_latency(guint order) {
+  return 0.5 * order;
+}
+
+// Finds the interval containing x, which must be within [-1, 1].
+static inline guint locate(const BtEdbAdaaTable* const self, gdouble x, gdouble* t) {
+  const gdouble pos = (x + 1) * self->scale;
+  const guint i = MIN((guint)pos, self->n - 2);
+  *t = pos - i;
+  return i;
+}
+
+// Cubic Hermite interpolation, given the values and slopes (per interval) at each end.
+static inline gdouble hermite(gdouble y0, gdouble y1, gdouble m0, gdouble m1, gdouble t) {
+  const gdouble t2 = t * t;
+  const gdouble t3 = t2 * t;
+  return (2*t3 - 3*t2 + 1) * y0 + (t3 - 2*t2 + t) * m0 + (-2*t3 + 3*t2) * y1 + (t3 - t2) * m1;
+}
+
+/*
+  Beyond magnitude 1, the antiderivatives are continued analytically from the ends of the table. "u" is the
+  magnitude. The curve is odd there, so the first antiderivative is even about the end of the table and the second
+  is odd.
+*/
+static inline gdouble tail_f1(const BtEdbAdaaTable* const self, const Tail* const tail, gdouble u) {
+  return self->postgain * ((u - 1) + (exp(-tail->k * u) - tail->exp_k) / tail->k);
+}
+
+static inline gdouble tail_f2(const BtEdbAdaaTable* const self, const Tail* const tail, gdouble u) {
+  const gdouble k = tail->k;
+  return self->postgain * ((u - 1) * (u - 1) / 2 + (tail->exp_k - exp(-k * u)) / (k * k) - tail->exp_k * (u - 1) / k);
+}
+
+// NaN inputs go to the positive tail, so that they can't produce an invalid index.
+static inline gdouble eval_f0(const BtEdbAdaaTable* const self, gdouble x) {
+  if (x < -1) {
+    return -(1 - exp(self->neg.k * x)) * self->postgain;
+  } else if (!(x < 1)) {
+    return (1 - exp(-self->pos.k * x)) * self->postgain;
+  } else {
+    gdouble t;
+    const guint i = locate(self, x, &t);
+    return self->f0[i] + (self->f0[i + 1] - self->f0[i]) * t;
+  }
+}
+
+static inline gdouble eval_f1(const BtEdbAdaaTable* const self, gdouble x) {
+  if (x < -1) {
+    return self->f1[0] + tail_f1(self, &self->neg, -x);
+  } else if (!(x < 1)) {
+    return self->f1[self->n - 1] + tail_f1(self, &self->pos, x);
+  } else {
+    gdouble t;
+    const guint i = locate(self, x, &t);
+    return hermite(self->f1[i], self->f1[i + 1], self->f0[i] * self->h, self->f0[i + 1] * self->h, t);
+  }
+}
+
+static inline gdouble eval_f2(const BtEdbAdaaTable* const self, gdouble x) {
+  if (x < -1) {
+    return self->f2[0] - self->f1[0] * (-x - 1) - tail_f2(self, &self->neg, -x);
+  } else if (!(x < 1)) {
+    const guint last = self->n - 1;
+    return self->f2[last] + self->f1[last] * (x - 1) + tail_f2(self, &self->pos, x);
+  } else {
+    gdouble t;
+    const guint i = locate(self, x, &t);
+    return hermite(self->f2[i], self->f2[i + 1], self->f1[i] * self->h, self->f1[i + 1] * self->h, t);
+  }
+}
+
+static inline gdouble first_order(const BtEdbAdaaTable* const self, gdouble x0, gdouble x1) {
+  const gdouble d = x0 - x1;
+  if (fabs(d) < EPSILON_1)
+    return eval_f0(self, (x0 + x1) / 2);
+  else
+    return (eval_f1(self, x0) - eval_f1(self, x1)) / d;
+}
+
+// The divided difference of the second antiderivative, which is the first order result for the first antiderivative.
+static inline gdouble divided_f2(const BtEdbAdaaTable* const self, gdouble x0, gdouble x1) {
+  const gdouble d = x0 - x1;
+  if (fabs(d) < EPSILON_1)
+    return eval_f1(self, (x0 + x1) / 2);
+  else
+    return (eval_f2(self, x0) - eval_f2(self, x1)) / d;
+}
+
+static inline gdouble second_order(const BtEdbAdaaTable* const self, gdouble x0, gdouble x1, gdouble x2) {
+  const gdouble d = x0 - x2;
+
+  if (fabs(d) < EPSILON_2) {
+    const gdouble x_bar = (x0 + x2) / 2;
+    const gdouble delta = x_bar - x1;
+
+    if (fabs(delta) < EPSILON_2)
+      return eval_f0(self, (x_bar + x1) / 2);
+    else
+      return 2 / delta * (eval_f1(self, x_bar) + (eval_f2(self, x1) - eval_f2(self, x_bar)) / delta);
+  } else {
+    return 2 / d * (divided_f2(self, x0, x1) - divided_f2(self, x1, x2));
+  }
+}
+
+void btedb_adaa_process(
+  const BtEdbAdaaTable* self, guint order, BtEdbAdaaState* state, gfloat* data, guint stride, guint nsamples) {
+
+  gdouble x1 = state->x1;
+  gdouble x2 = state->x2;
+
+  if (order == 1) {
+    for (guint i = 0; i < nsamples; ++i) {
+      const gdouble x0 = data[i * stride];
+      data[i * stride] = first_order(self, x0, x1);
+      x1 = x0;
+    }
+  } else {
+    for (guint i = 0; i < nsamples; ++i) {
+      const gdouble x0 = data[i * stride];
+      data[i * stride] = second_order(self, x0, x1, x2);
+      x2 = x1;
+      x1 = x0;
+    }
+  }
+
+  state->x1 = x1;
+  state->x2 = x2;
+}
@@ -0,0 +1,58 @@
+/*
+  Distort effect for Buzztrax
+  Copyright (C) 2020 David Beswick
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "src/kernel.h"
+
+typedef struct _BtEdbAdaaTable BtEdbAdaaTable;
+
+// The previous inputs of one channel.
+typedef struct {
+  gdouble x1;
+  gdouble x2;
+} BtEdbAdaaState;
+
+/*
+  Antiderivative anti-aliasing, which applies the curve to the signal as if it were continuous between samples and
+  then averages the result over each sample period. This suppresses much of the aliasing that the distortion would
+  otherwise cause, at a fraction of the cost of oversampling.
+
+  First order processing uses the first antiderivative of the curve and delays the signal by half a sample. Second
+  order uses the second antiderivative, and suppresses aliasing further at the cost of a one sample delay and some
+  loss of treble.
+
+  The antiderivatives are integrated numerically into a table of "size" points on each side of zero. Like
+  BtEdbCurveTable, tables are immutable and reference counted so that they can be built on another thread.
+*/
+BtEdbAdaaTable* btedb_adaa_table_new(const BtEdbDistortParams* params, guint size);
+BtEdbAdaaTable* btedb_adaa_table_ref(BtEdbAdaaTable* self);
+void btedb_adaa_table_unref(BtEdbAdaaTable* self);
+
+// True if the table was built from the given settings, and so doesn't need to be rebuilt.
+gboolean btedb_adaa_table_matches(const BtEdbAdaaTable* self, const BtEdbDistortParams* params, guint size);
+
+/*
+  Processes "nsamples" samples of one channel in-place. Consecutive samples are "stride" values apart. "order" is 1 or
+  2.
+*/
+void btedb_adaa_process(
+  const BtEdbAdaaTable* self, guint order, BtEdbAdaaState* state, gfloat* data, guint stride, guint nsamples);
+
+// The delay caused by processing, in samples.
+gdouble btedb_adaa_latency(guint order);
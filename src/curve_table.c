@@ -0,0 +1,141 @@
+/*
+  Distort effect for Buzztrax
+  Copyright (C) 2020 David Beswick
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "config.h"
+#include "src/curve_table.h"
+
+#include <math.h>
+#include <string.h>
+
+typedef struct {
+  // Index 0 is magnitude 0 and index size-1 is magnitude 1. There's one extra entry before and after, for the cubic
+  // interpolator.
+  gfloat* values;
+
+  // For magnitudes over 1, the curve is (1 - exp(-k * magnitude)) * postgain.
+  gfloat k;
+} Curve;
+
+struct _BtEdbCurveTable {
+  gint refcount;
+
+  BtEdbDistortParams params;
+  guint size;
+  BtEdbInterp interp;
+
+  gfloat scale;
+  gfloat postgain;
+  Curve pos;
+  Curve neg;
+};
+
+static void curve_init(Curve* curve, gfloat* storage, const BtEdbDistortParams* params, guint size, gboolean negative) {
+  const gfloat sign = negative ? -1.0f : 1.0f;
+
+  curve->values = storage + 1;
+
+  // The reference kernel is used to build the table, so that the table is as close as possible to "exact" mode.
+  for (guint i = 0; i <= size; ++i) {
+    curve->values[i] = sign * (gfloat)i / (size - 1);
+  }
+  btedb_kernel_scalar(params, curve->values, size + 1);
+  for (guint i = 0; i <= size; ++i) {
+    curve->values[i] *= sign;
+  }
+
+  curve->values[-1] = 2 * curve->values[0] - curve->values[1];
+
+  const gfloat pregain = btedb_db_to_gain(negative ? params->neg_db_pregain : params->pos_db_pregain);
+  const gfloat shape_b = negative ? params->neg_shape_b : params->pos_shape_b;
+  const gfloat shape_exp = negative ? params->neg_shape_exp : params->pos_shape_exp;
+  curve->k = pregain / powf(shape_b, shape_exp);
+}
+
+BtEdbCurveTable* btedb_curve_table_new(const BtEdbDistortParams* params, guint size, BtEdbInterp interp) {
+  g_assert(size >= 2);
+
+  const guint curve_len = size + 2;
+  const guint ncurves = params->symmetric ? 1 : 2;
+  BtEdbCurveTable* self = g_malloc(sizeof(BtEdbCurveTable) + sizeof(gfloat) * curve_len * ncurves);
+  gfloat* const storage = (gfloat*)(self + 1);
+
+  self->refcount = 1;
+  self->params = *params;
+  self->size = size;
+  self->interp = interp;
+  self->scale = size - 1;
+  self->postgain = btedb_db_to_gain(params->db_postgain);
+
+  curve_init(&self->pos, storage, params, size, FALSE);
+  if (params->symmetric)
+    self->neg = self->pos;
+  else
+    curve_init(&self->neg, storage + curve_len, params, size, TRUE);
+
+  return self;
+}
+
+BtEdbCurveTable* btedb_curve_table_ref(BtEdbCurveTable* self) {
+  g_atomic_int_inc(&self->refcount);
+  return self;
+}
+
+void btedb_curve_table_unref(BtEdbCurveTable* self) {
+  if (g_atomic_int_dec_and_test(&self->refcount))
+    g_free(self);
+}
+
+gboolean btedb_curve_table_matches(
+  const BtEdbCurveTable* self, const BtEdbDistortParams* params, guint size, BtEdbInterp interp) {
+
+  return self->size == size && self->interp == interp && memcmp(&self->params, params, sizeof(*params)) == 0;
+}
+
+static inline gfloat lookup(const BtEdbCurveTable* const self, const Curve* const curve, gfloat x_abs,
+                            const BtEdbInterp interp) {
+  // Written so that NaN also takes this path, rather than producing an invalid index.
+  if (!(x_abs < 1.0f))
+    return (1.0f - expf(-x_abs * curve->k)) * self->postgain;
+
+  const gfloat pos = x_abs * self->scale;
+  const guint i = (guint)pos;
+  const gfloat f = pos - i;
+  const gfloat* const v = curve->values + i;
+
+  if (interp == BTEDB_INTERP_LINEAR) {
+    return v[0] + (v[1] - v[0]) * f;
+  } else {
+    // Catmull-Rom
+    return v[0] + 0.5f * f * (v[1] - v[-1] + f * (2*v[-1] - 5*v[0] + 4*v[1] - v[2] + f * (3*(v[0] - v[1]) + v[2] - v[-1])));
+  }
+}
+
+static inline void process(const BtEdbCurveTable* const self, gfloat* data, guint nsamples, const BtEdbInterp interp) {
+  for (guint i = 0; i < nsamples; ++i) {
+    const gboolean negative = data[i] < 0;
+    const gfloat y = lookup(self, negative ? &self->neg : &self->pos, fabsf(data[i]), interp);
+    data[i] = negative ? -y : y;
+  }
+}
+
+void btedb_curve_table_process(const BtEdbCurveTable* self, gfloat* data, guint nsamples) {
+  if (self->interp == BTEDB_INTERP_LINEAR)
+    process(self, data, nsamples, BTEDB_INTERP_LINEAR);
+  else
+    process(self, data, nsamples, BTEDB_INTERP_CUBIC);
+}
@@ -0,0 +1,48 @@
+/*
+  Distort effect for Buzztrax
+  Copyright (C) 2020 David Beswick
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "src/kernel.h"
+
+typedef enum {
+  BTEDB_INTERP_LINEAR,
+  BTEDB_INTERP_CUBIC
+} BtEdbInterp;
+
+typedef struct _BtEdbCurveTable BtEdbCurveTable;
+
+/*
+  A tabulated copy of the distortion curve, so that processing costs a table lookup per sample rather than an exp and
+  a pow.
+
+  The curve is only tabulated for input magnitudes up to 1, which is the range in which the shape is interpolated.
+  Past that, the shape is constant and the curve is evaluated directly.
+
+  Tables are immutable once built and are reference counted, so that a new table can be built on another thread while
+  the old one is still in use.
+*/
+BtEdbCurveTable* btedb_curve_table_new(const BtEdbDistortParams* params, guint size, BtEdbInterp interp);
+BtEdbCurveTable* btedb_curve_table_ref(BtEdbCurveTable* self);
+void btedb_curve_table_unref(BtEdbCurveTable* self);
+
+// True if the table was built from the given settings, and so doesn't need to be rebuilt.
+gboolean btedb_curve_table_matches(
+  const BtEdbCurveTable* self, const BtEdbDistortParams* params, guint size, BtEdbInterp interp);
+
+void btedb_curve_table_process(const BtEdbCurveTable* self, gfloat* data, guint nsamples);
@@ -0,0 +1,57 @@
+/*
+  Distort effect for Buzztrax
+  Copyright (C) 2020 David Beswick
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <glib.h>
+
+/*
+  Numbers too small for the normal floating point range ("denormals") are very slow on many CPUs. They appear in the
+  decaying tails of filters, and in the distortion curve as the input fades to silence, where they make no audible
+  difference.
+
+  These functions set the current thread to flush them to zero, and restore the previous setting afterwards. As the
+  streaming thread may be shared with other elements, the setting is only changed while this element is processing.
+*/
+typedef guint64 BtEdbFpMode;
+
+static inline BtEdbFpMode btedb_denormals_disable(void) {
+#if defined(__SSE2__)
+  // Flush to zero (bit 15) and denormals are zero (bit 6).
+  const guint mxcsr = __builtin_ia32_stmxcsr();
+  __builtin_ia32_ldmxcsr(mxcsr | 0x8040);
+  return mxcsr;
+#elif defined(__aarch64__)
+  // Flush to zero (bit 24), which covers both inputs and outputs.
+  const guint64 fpcr = __builtin_aarch64_get_fpcr64();
+  __builtin_aarch64_set_fpcr64(fpcr | (1 << 24));
+  return fpcr;
+#else
+  return 0;
+#endif
+}
+
+static inline void btedb_denormals_restore(BtEdbFpMode mode) {
+#if defined(__SSE2__)
+  __builtin_ia32_ldmxcsr((guint)mode);
+#elif defined(__aarch64__)
+  __builtin_aarch64_set_fpcr64(mode);
+#else
+  (void)mode;
+#endif
+}
@@ -0,0 +1,191 @@
+/*
+  Distort effect for Buzztrax
+  Copyright (C) 2020 David Beswick
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "config.h"
+#include "src/kernel.h"
+
+#include <float.h>
+#include <math.h>
+
+static const BtEdbKernelSet* kernels = &btedb_kernels_scalar;
+
+gfloat btedb_db_to_gain(gfloat db) {
+  return powf(10.0f, db / 20.0f);
+}
+
+static inline gfloat plerp(gfloat a, gfloat b, gfloat alpha, gfloat power) {
+  return powf(a + (b-a) * MAX(MIN(alpha,1),0), power);
+}
+
+void btedb_kernel_scalar(const BtEdbDistortParams* const params, gfloat* data, guint nsamples) {
+  const gfloat pos_pregain = btedb_db_to_gain(params->pos_db_pregain);
+  const gfloat neg_pregain = btedb_db_to_gain(params->neg_db_pregain);
+  const gfloat postgain = btedb_db_to_gain(params->db_postgain);
+
+  for (guint i = 0; i < nsamples; i++) {
+    const gboolean negative = data[i] < 0;
+    const gboolean use_pos_values = params->symmetric || !negative;
+    const gfloat shape0 = use_pos_values ? params->pos_shape_a : params->neg_shape_a;
+    const gfloat shape1 = use_pos_values ? params->pos_shape_b : params->neg_shape_b;
+    const gfloat shape_exp = use_pos_values ? params->pos_shape_exp : params->neg_shape_exp;
+    const gfloat pregain = use_pos_values ? pos_pregain : neg_pregain;
+
+    const gfloat data_abs = fabs(data[i]);
+    data[i] = (1-exp(-fabs(data_abs * pregain)/plerp(shape0, shape1, data_abs, shape_exp))) * postgain;
+
+    if (negative)
+      data[i] *= -1;
+  }
+}
+
+void btedb_kernel_f64(
+  const BtEdbDistortParams* const params, const BtEdbGainRamp* const gains, gdouble* data, guint nsamples) {
+
+  for (guint i = 0; i < nsamples; i++) {
+    const gboolean negative = data[i] < 0;
+    const gboolean use_pos_values = params->symmetric || !negative;
+    const gdouble shape0 = use_pos_values ? params->pos_shape_a : params->neg_shape_a;
+    const gdouble shape1 = use_pos_values ? params->pos_shape_b : params->neg_shape_b;
+    const gdouble shape_exp = use_pos_values ? params->pos_shape_exp : params->neg_shape_exp;
+    const gdouble pregain = use_pos_values ?
+      gains->pos_pregain + (gdouble)gains->pos_pregain_step * i :
+      gains->neg_pregain + (gdouble)gains->neg_pregain_step * i;
+    const gdouble postgain = gains->postgain + (gdouble)gains->postgain_step * i;
+
+    const gdouble data_abs = fabs(data[i]);
+    const gdouble base = MAX(shape0 + (shape1 - shape0) * MIN(data_abs, 1), DBL_MIN);
+    const gdouble y = (1 - exp(-data_abs * pregain / pow(base, shape_exp))) * postgain;
+    data[i] = negative ? -y : y;
+  }
+}
+
+gfloat btedb_kernel_const_shape_factor(gfloat shape, gfloat shape_exp) {
+  const gfloat denom = powf(shape, shape_exp);
+  return denom > 0 ? 1 / denom : FLT_MAX;
+}
+
+void btedb_gain_ramp_init(BtEdbGainRamp* ramp, const BtEdbDistortParams* params) {
+  ramp->pos_pregain = btedb_db_to_gain(params->pos_db_pregain);
+  ramp->neg_pregain = btedb_db_to_gain(params->neg_db_pregain);
+  ramp->postgain = btedb_db_to_gain(params->db_postgain);
+  ramp->pos_pregain_step = 0;
+  ramp->neg_pregain_step = 0;
+  ramp->postgain_step = 0;
+}
+
+void btedb_gain_ramp_to(BtEdbGainRamp* ramp, const BtEdbGainRamp* target, guint nsamples) {
+  ramp->pos_pregain_step = (target->pos_pregain - ramp->pos_pregain) / nsamples;
+  ramp->neg_pregain_step = (target->neg_pregain - ramp->neg_pregain) / nsamples;
+  ramp->postgain_step = (target->postgain - ramp->postgain) / nsamples;
+}
+
+void btedb_gain_ramp_advance(BtEdbGainRamp* ramp, guint nsamples) {
+  ramp->pos_pregain += ramp->pos_pregain_step * nsamples;
+  ramp->neg_pregain += ramp->neg_pregain_step * nsamples;
+  ramp->postgain += ramp->postgain_step * nsamples;
+}
+
+static inline __attribute__((always_inline)) void process(
+  const BtEdbDistortParams* const params, const BtEdbGainRamp* const gains, gfloat* data, guint nsamples,
+  const gboolean symmetric, const BtEdbKernelRegime regime) {
+
+  const gfloat pos_factor = btedb_kernel_const_shape_factor(params->pos_shape_a, params->pos_shape_exp);
+  const gfloat neg_factor = btedb_kernel_const_shape_factor(params->neg_shape_a, params->neg_shape_exp);
+
+  for (guint i = 0; i < nsamples; i++) {
+    const gboolean negative = data[i] < 0;
+    const gboolean use_pos_values = symmetric || !negative;
+    const gfloat data_abs = fabsf(data[i]);
+    const gfloat pos_pregain = gains->pos_pregain + gains->pos_pregain_step * i;
+    const gfloat neg_pregain = gains->neg_pregain + gains->neg_pregain_step * i;
+    const gfloat postgain = gains->postgain + gains->postgain_step * i;
+
+    gfloat t;
+    if (regime == BTEDB_KERNEL_CONST_SHAPE) {
+      const gfloat k = use_pos_values ? pos_pregain * pos_factor : neg_pregain * neg_factor;
+      t = data_abs * MIN(k, FLT_MAX);
+    } else {
+      const gfloat shape0 = use_pos_values ? params->pos_shape_a : params->neg_shape_a;
+      const gfloat shape1 = use_pos_values ? params->pos_shape_b : params->neg_shape_b;
+      const gfloat pregain = use_pos_values ? pos_pregain : neg_pregain;
+      const gfloat base = MAX(shape0 + (shape1 - shape0) * MIN(data_abs, 1), FLT_MIN);
+
+      gfloat denom;
+      if (regime == BTEDB_KERNEL_LINEAR_SHAPE) {
+        denom = base;
+      } else {
+        denom = powf(base, use_pos_values ? params->pos_shape_exp : params->neg_shape_exp);
+      }
+
+      t = data_abs * pregain / denom;
+    }
+
+    const gfloat y = (1 - expf(-t)) * postgain;
+    data[i] = negative ? -y : y;
+  }
+}
+
+BTEDB_KERNEL_DEFINE_SET(btedb_kernels_scalar, "scalar", process)
+
+void btedb_kernel_init(void) {
+#if HAVE_X86_KERNELS
+  __builtin_cpu_init();
+
+  // The AVX2 kernel is compiled with FMA enabled, so both are required.
+  if (__builtin_cpu_supports("avx512f"))
+    kernels = &btedb_kernels_avx512;
+  else if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+    kernels = &btedb_kernels_avx2;
+  else if (__builtin_cpu_supports("sse2"))
+    kernels = &btedb_kernels_sse2;
+#endif
+}
+
+const char* btedb_kernel_name(void) {
+  return kernels->name;
+}
+
+static BtEdbKernelRegime regime(gfloat shape_a, gfloat shape_b, gfloat shape_exp) {
+  if (shape_a == shape_b)
+    return BTEDB_KERNEL_CONST_SHAPE;
+  else if (shape_exp == 1.0f)
+    return BTEDB_KERNEL_LINEAR_SHAPE;
+  else
+    return BTEDB_KERNEL_GENERAL;
+}
+
+BtEdbDistortKernel btedb_kernel_set_select(const BtEdbKernelSet* set, const BtEdbDistortParams* params) {
+  const BtEdbKernelRegime pos = regime(params->pos_shape_a, params->pos_shape_b, params->pos_shape_exp);
+
+  if (params->symmetric) {
+    return set->symmetric[pos];
+  } else {
+    const BtEdbKernelRegime neg = regime(params->neg_shape_a, params->neg_shape_b, params->neg_shape_exp);
+    return set->asymmetric[MAX(pos, neg)];
+  }
+}
+
+BtEdbDistortKernel btedb_kernel_select(const BtEdbDistortParams* params) {
+  return btedb_kernel_set_select(kernels, params);
+}
+
+void btedb_distort(const BtEdbDistortParams* const params, gfloat* data, guint nsamples) {
+  BtEdbGainRamp gains;
+  btedb_gain_ramp_init(&gains, params);
+  btedb_kernel_select(params)(params, &gains, data, nsamples);
+}
@@ -0,0 +1,148 @@
+/*
+  Distort effect for Buzztrax
+  Copyright (C) 2020 David Beswick
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <glib.h>
+
+/*
+  The values that define the distortion curve. These are the element's properties, minus those that only affect how
+  the curve is applied (i.e. oversampling.)
+
+  Nothing here depends on GStreamer, so that the kernels can also be used outside of a pipeline.
+*/
+typedef struct {
+  gfloat pos_db_pregain;
+  gfloat pos_shape_a;
+  gfloat pos_shape_b;
+  gfloat pos_shape_exp;
+  gboolean symmetric;
+  gfloat neg_db_pregain;
+  gfloat neg_shape_a;
+  gfloat neg_shape_b;
+  gfloat neg_shape_exp;
+  gfloat db_postgain;
+} BtEdbDistortParams;
+
+/*
+  The linear pregains and postgain at the first sample, and the amount that each changes by per sample. Parameter
+  changes are ramped in rather than applied at once, so that they don't cause clicks.
+
+  Kernels don't change the ramp. Use btedb_gain_ramp_advance to move it past the samples that have been processed.
+*/
+typedef struct {
+  gfloat pos_pregain;
+  gfloat neg_pregain;
+  gfloat postgain;
+  gfloat pos_pregain_step;
+  gfloat neg_pregain_step;
+  gfloat postgain_step;
+} BtEdbGainRamp;
+
+typedef void (*BtEdbDistortKernel)(
+  const BtEdbDistortParams* params, const BtEdbGainRamp* gains, gfloat* data, guint nsamples);
+
+/*
+  Many settings reduce to simpler maths, and each kernel set has a variant specialized for each of these regimes.
+  Each regime can also process the ones before it.
+*/
+typedef enum {
+  // shape_a == shape_b, so the divisor is constant and can be folded into the pregain.
+  BTEDB_KERNEL_CONST_SHAPE,
+  // shape_exp == 1, so no pow is needed.
+  BTEDB_KERNEL_LINEAR_SHAPE,
+  BTEDB_KERNEL_GENERAL,
+  BTEDB_KERNEL_N_REGIMES
+} BtEdbKernelRegime;
+
+typedef struct {
+  const char* name;
+  BtEdbDistortKernel symmetric[BTEDB_KERNEL_N_REGIMES];
+  BtEdbDistortKernel asymmetric[BTEDB_KERNEL_N_REGIMES];
+} BtEdbKernelSet;
+
+/*
+  Defines a BtEdbKernelSet called "set_name" from "process_func", which must be an inline function taking the usual
+  kernel arguments followed by constant "symmetric" and "regime" arguments.
+*/
+#define BTEDB_KERNEL_VARIANT(process_func, suffix, symmetric, regime) \
+  static void process_func##_##suffix( \
+    const BtEdbDistortParams* params, const BtEdbGainRamp* gains, gfloat* data, guint nsamples) { \
+    process_func(params, gains, data, nsamples, symmetric, regime); \
+  }
+
+#define BTEDB_KERNEL_DEFINE_SET(set_name, label, process_func) \
+  BTEDB_KERNEL_VARIANT(process_func, sym_const, TRUE, BTEDB_KERNEL_CONST_SHAPE) \
+  BTEDB_KERNEL_VARIANT(process_func, sym_linear, TRUE, BTEDB_KERNEL_LINEAR_SHAPE) \
+  BTEDB_KERNEL_VARIANT(process_func, sym_general, TRUE, BTEDB_KERNEL_GENERAL) \
+  BTEDB_KERNEL_VARIANT(process_func, asym_const, FALSE, BTEDB_KERNEL_CONST_SHAPE) \
+  BTEDB_KERNEL_VARIANT(process_func, asym_linear, FALSE, BTEDB_KERNEL_LINEAR_SHAPE) \
+  BTEDB_KERNEL_VARIANT(process_func, asym_general, FALSE, BTEDB_KERNEL_GENERAL) \
+  const BtEdbKernelSet set_name = { \
+    label, \
+    { process_func##_sym_const, process_func##_sym_linear, process_func##_sym_general }, \
+    { process_func##_asym_const, process_func##_asym_linear, process_func##_asym_general } \
+  };
+
+extern const BtEdbKernelSet btedb_kernels_scalar;
+#if HAVE_X86_KERNELS
+extern const BtEdbKernelSet btedb_kernels_sse2;
+extern const BtEdbKernelSet btedb_kernels_avx2;
+extern const BtEdbKernelSet btedb_kernels_avx512;
+#endif
+
+/*
+  Chooses the fastest kernel set supported by the CPU. Call once, before any call to btedb_kernel_select.
+*/
+void btedb_kernel_init(void);
+const char* btedb_kernel_name(void);
+
+/*
+  Returns the fastest kernel for the given parameters. The result is only valid while the parameters are unchanged,
+  so it should be chosen again whenever they change.
+*/
+BtEdbDistortKernel btedb_kernel_select(const BtEdbDistortParams* params);
+BtEdbDistortKernel btedb_kernel_set_select(const BtEdbKernelSet* set, const BtEdbDistortParams* params);
+
+/*
+  Applies the distortion curve in-place, choosing a kernel on each call. The gains are held at the values in "params".
+*/
+void btedb_distort(const BtEdbDistortParams* params, gfloat* data, guint nsamples);
+
+gfloat btedb_db_to_gain(gfloat db);
+
+// Sets "ramp" to hold the gains in "params" steady.
+void btedb_gain_ramp_init(BtEdbGainRamp* ramp, const BtEdbDistortParams* params);
+
+// Sets the steps so that the gains reach those at the start of "target" after "nsamples" samples.
+void btedb_gain_ramp_to(BtEdbGainRamp* ramp, const BtEdbGainRamp* target, guint nsamples);
+
+// Moves the start of the ramp forward by "nsamples" samples.
+void btedb_gain_ramp_advance(BtEdbGainRamp* ramp, guint nsamples);
+
+/*
+  The factor that replaces 1 / pow(shape, shape_exp) in the constant shape regime, where it's multiplied by the
+  pregain. A zero divisor gives the largest finite value, so that silence stays silent.
+*/
+gfloat btedb_kernel_const_shape_factor(gfloat shape, gfloat shape_exp);
+
+// The reference implementation, which all other kernels are measured against.
+void btedb_kernel_scalar(const BtEdbDistortParams* params, gfloat* data, guint nsamples);
+
+// A double precision kernel for 64-bit float streams, so that they lose no precision in exact mode.
+void btedb_kernel_f64(const BtEdbDistortParams* params, const BtEdbGainRamp* gains, gdouble* data, guint nsamples);
@@ -0,0 +1,23 @@
+/*
+  Distort effect for Buzztrax
+  Copyright (C) 2020 David Beswick
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+// Built with -mavx2 -mfma, see Makefile.am.
+#define BTEDB_SIMD_BYTES 32
+#define BTEDB_SIMD_SET btedb_kernels_avx2
+#define BTEDB_SIMD_LABEL "avx2"
+#include "src/kernel_simd.h"
@@ -0,0 +1,224 @@
+/*
+  Distort effect for Buzztrax
+  Copyright (C) 2020 David Beswick
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/*
+  A vectorized version of the distortion curve, written with GCC's generic vector extensions.
+
+  This file is included once by each of the kernel_*.c files, which are compiled with different instruction set flags.
+  Before including it, define:
+
+    BTEDB_SIMD_BYTES: the vector width in bytes.
+    BTEDB_SIMD_SET: the name of the BtEdbKernelSet to generate.
+    BTEDB_SIMD_LABEL: the name of the instruction set, as a string.
+
+  libm can't be called per-lane, so exp and pow are replaced with the Cephes exp2f and logf polynomials. The choice
+  between positive and negative parameters is made with bit masks rather than branches.
+
+  "process" is instantiated once per parameter regime by BTEDB_KERNEL_DEFINE_SET, with constant flags that let the
+  compiler drop the work that a regime doesn't need.
+*/
+
+#include "config.h"
+#include "src/kernel.h"
+
+#include <float.h>
+#include <math.h>
+#include <string.h>
+
+#if !defined(BTEDB_SIMD_BYTES) || !defined(BTEDB_SIMD_SET) || !defined(BTEDB_SIMD_LABEL)
+#error "BTEDB_SIMD_BYTES, BTEDB_SIMD_SET and BTEDB_SIMD_LABEL must be defined"
+#endif
+
+#define VEC_LANES (BTEDB_SIMD_BYTES / sizeof(gfloat))
+
+typedef gfloat vf __attribute__((vector_size(BTEDB_SIMD_BYTES)));
+typedef gint32 vi __attribute__((vector_size(BTEDB_SIMD_BYTES)));
+
+typedef struct {
+  vf pos_shape_a;
+  vf pos_shape_b;
+  vf pos_shape_exp;
+  vf neg_shape_a;
+  vf neg_shape_b;
+  vf neg_shape_exp;
+  vf pos_factor;
+  vf neg_factor;
+} VecParams;
+
+// The gains for each lane of one vector of samples.
+typedef struct {
+  vf pos_pregain;
+  vf neg_pregain;
+  vf postgain;
+} VecGains;
+
+static inline vf vf_splat(gfloat x) {
+  return (vf){0} + x;
+}
+
+static inline vf vf_select(vi mask, vf a, vf b) {
+  return (vf)((mask & (vi)a) | (~mask & (vi)b));
+}
+
+static inline vf vf_min(vf a, vf b) {
+  return vf_select(a < b, a, b);
+}
+
+static inline vf vf_max(vf a, vf b) {
+  return vf_select(a > b, a, b);
+}
+
+static inline vf vf_floor(vf x) {
+  const vf t = __builtin_convertvector(__builtin_convertvector(x, vi), vf);
+  return t - (vf)((t > x) & (vi)vf_splat(1.0f));
+}
+
+static inline vf vf_exp2(vf x) {
+  x = vf_max(vf_min(x, vf_splat(126.0f)), vf_splat(-126.0f));
+
+  const vf xi = vf_floor(x + 0.5f);
+  const vf f = x - xi;
+
+  vf p = vf_splat(1.535336188319500e-4f);
+  p = p * f + 1.339887440266574e-3f;
+  p = p * f + 9.618437357674640e-3f;
+  p = p * f + 5.550332471162809e-2f;
+  p = p * f + 2.402264791363012e-1f;
+  p = p * f + 6.931472028550421e-1f;
+  p = p * f + 1.0f;
+
+  const vi e = (__builtin_convertvector(xi, vi) + 127) << 23;
+  return p * (vf)e;
+}
+
+static inline vf vf_log2(vf x) {
+  // pow(0, y) is handled by clamping: exp2 of the resulting large negative exponent is clamped in turn.
+  x = vf_max(x, vf_splat(FLT_MIN));
+
+  const vi bits = (vi)x;
+  vi e = ((bits >> 23) & 0xff) - 126;
+  vf m = (vf)((bits & 0x007fffff) | 0x3f000000);
+
+  const vi small = m < 0.707106781186547524f;
+  e = e + small;
+  m = m + (vf)(small & (vi)m) - 1.0f;
+
+  const vf z = m * m;
+  vf y = vf_splat(7.0376836292e-2f);
+  y = y * m - 1.1514610310e-1f;
+  y = y * m + 1.1676998740e-1f;
+  y = y * m - 1.2420140846e-1f;
+  y = y * m + 1.4249322787e-1f;
+  y = y * m - 1.6668057665e-1f;
+  y = y * m + 2.0000714765e-1f;
+  y = y * m - 2.4999993993e-1f;
+  y = y * m + 3.3333331174e-1f;
+  y = y * m * z - 0.5f * z;
+
+  return (m + y) * (gfloat)M_LOG2E + __builtin_convertvector(e, vf);
+}
+
+static inline __attribute__((always_inline)) vf transfer(
+  const VecParams* const p, const VecGains* const g, vf x, const gboolean symmetric, const BtEdbKernelRegime regime) {
+
+  // Not vf_splat(-0.0f), which is +0 unless -ffast-math happens to fold the addition away.
+  const vi sign = (vi)x & G_MININT32;
+  const vi use_neg = symmetric ? (vi){0} : (x < 0);
+  const vf x_abs = (vf)((vi)x & ~sign);
+
+  vf t;
+  if (regime == BTEDB_KERNEL_CONST_SHAPE) {
+    const vf pos_k = g->pos_pregain * p->pos_factor;
+    const vf k = symmetric ? pos_k : vf_select(use_neg, g->neg_pregain * p->neg_factor, pos_k);
+    t = x_abs * vf_min(k, vf_splat(FLT_MAX));
+  } else {
+    const vf shape0 = symmetric ? p->pos_shape_a : vf_select(use_neg, p->neg_shape_a, p->pos_shape_a);
+    const vf shape1 = symmetric ? p->pos_shape_b : vf_select(use_neg, p->neg_shape_b, p->pos_shape_b);
+    const vf pregain = symmetric ? g->pos_pregain : vf_select(use_neg, g->neg_pregain, g->pos_pregain);
+
+    const vf base = vf_max(shape0 + (shape1 - shape0) * vf_min(x_abs, vf_splat(1.0f)), vf_splat(FLT_MIN));
+
+    vf denom;
+    if (regime == BTEDB_KERNEL_LINEAR_SHAPE) {
+      denom = base;
+    } else {
+      const vf shape_exp =
+        symmetric ? p->pos_shape_exp : vf_select(use_neg, p->neg_shape_exp, p->pos_shape_exp);
+      denom = vf_exp2(shape_exp * vf_log2(base));
+    }
+
+    t = x_abs * pregain / denom;
+  }
+
+  const vf y = (1.0f - vf_exp2(-t * (gfloat)M_LOG2E)) * g->postgain;
+
+  return (vf)((vi)y | sign);
+}
+
+/*
+  Gains are calculated from the sample index rather than accumulated, so that long ramps don't drift.
+*/
+static inline VecGains gains_at(const BtEdbGainRamp* const gains, const vf lane, guint i) {
+  const vf index = lane + (gfloat)i;
+  return (VecGains){
+    .pos_pregain = gains->pos_pregain + index * gains->pos_pregain_step,
+    .neg_pregain = gains->neg_pregain + index * gains->neg_pregain_step,
+    .postgain = gains->postgain + index * gains->postgain_step
+  };
+}
+
+static inline __attribute__((always_inline)) void process(
+  const BtEdbDistortParams* const params, const BtEdbGainRamp* const gains, gfloat* data, guint nsamples,
+  const gboolean symmetric, const BtEdbKernelRegime regime) {
+
+  const VecParams p = {
+    .pos_shape_a = vf_splat(params->pos_shape_a),
+    .pos_shape_b = vf_splat(params->pos_shape_b),
+    .pos_shape_exp = vf_splat(params->pos_shape_exp),
+    .neg_shape_a = vf_splat(params->neg_shape_a),
+    .neg_shape_b = vf_splat(params->neg_shape_b),
+    .neg_shape_exp = vf_splat(params->neg_shape_exp),
+    .pos_factor = vf_splat(btedb_kernel_const_shape_factor(params->pos_shape_a, params->pos_shape_exp)),
+    .neg_factor = vf_splat(btedb_kernel_const_shape_factor(params->neg_shape_a, params->neg_shape_exp))
+  };
+
+  vf lane;
+  for (guint l = 0; l < VEC_LANES; ++l) {
+    lane[l] = l;
+  }
+
+  guint i = 0;
+  for (; i + VEC_LANES <= nsamples; i += VEC_LANES) {
+    const VecGains g = gains_at(gains, lane, i);
+    vf x;
+    memcpy(&x, data + i, sizeof(x));
+    x = transfer(&p, &g, x, symmetric, regime);
+    memcpy(data + i, &x, sizeof(x));
+  }
+
+  // The remainder is padded out to a full vector, so that all samples see the same approximations.
+  if (i < nsamples) {
+    const VecGains g = gains_at(gains, lane, i);
+    vf x = {0};
+    memcpy(&x, data + i, (nsamples - i) * sizeof(gfloat));
+    x = transfer(&p, &g, x, symmetric, regime);
+    memcpy(data + i, &x, (nsamples - i) * sizeof(gfloat));
+  }
+}
+
+BTEDB_KERNEL_DEFINE_SET(BTEDB_SIMD_SET, BTEDB_SIMD_LABEL, process)
@@ -17,23 +17,131 @@
 */
 
 #include "config.h"
+#include "src/adaa.h"
+#include "src/curve_table.h"
 #include "src/debug.h"
+#include "src/denormals.h"
+#include "src/kernel.h"
+#include "src/oversampler.h"
+#include "src/pipeline.h"
+#include "src/polynomial.h"
 #include "src/properties_simple.h"
+#include "src/sample_format.h"
+#include "src/stats.h"
+#include "src/triple_buffer.h"
+#include "src/workers.h"
 
 #include "libbuzztrax-gst/ui.h"
 
 #include <gst/gstbin.h>
+#include <gst/audio/audio-buffer.h>
 #include <gst/audio/audio-format.h>
+#include <gst/audio/audio-info.h>
 #include <gst/audio/audio-resampler.h>
 #include <gst/base/gstbasetransform.h>
 
 #include <math.h>
+#include <string.h>
 
 #define GFX_WIDTH 64
 #define GFX_HEIGHT 64
+// The curve preview is invalidated at most this often, however quickly properties change, in microseconds.
+#define GFX_MIN_INTERVAL (50 * G_TIME_SPAN_MILLISECOND)
+
+// Automation is applied, and gain changes are ramped, over blocks of this many frames at the unoversampled rate.
+#define CONTROL_INTERVAL_FRAMES 64
+
+/*
+  Buffers are only split across threads when each thread gets at least this many samples to distort, counting
+  oversampled samples. Below that, waking the threads costs more than it saves.
+*/
+#define PARALLEL_MIN_SAMPLES 16384
+
+// Samples that aren't 32-bit floats are converted in blocks of this size, which fit easily in cache.
+#define CONVERT_SAMPLES 256
+
+/*
+  Buffers that this element allocates are aligned to cache lines, which also suits the widest vector loads used by the
+  kernels.
+*/
+#define BUFFER_ALIGN 64
+
+// Output buffers are made large enough for this much audio at first, in ms, and are enlarged if a buffer doesn't fit.
+#define POOL_BUFFER_TIME 100
+
+/*
+  Frames of input kept for priming a new internal oversampler. That's more than the longest tail of any oversampler,
+  so that its filters can be filled completely.
+*/
+#define HISTORY_FRAMES 256
+
+/*
+  The QoS governor makes processing cheaper when playback falls behind, a level at a time: first by using a curve table
+  rather than the exact curve, then by halving the internal oversampling factor. A level is held for at least
+  QOS_STEP_HOLD before the next step down. Quality is restored a level at a time after "qos_recover_hold" without
+  falling behind, which doubles up to QOS_RECOVER_HOLD_MAX whenever restoring a level doesn't last. Times are in
+  nanoseconds of audio processed.
+*/
+#define QOS_STEP_HOLD (250 * GST_MSECOND)
+#define QOS_RECOVER_HOLD (2 * GST_SECOND)
+#define QOS_RECOVER_HOLD_MAX (32 * GST_SECOND)
+// Below this load, making this element cheaper wouldn't help much.
+#define QOS_LOAD_SIGNIFICANT 0.05
+// A level is only restored if twice the current load, which is roughly the cost of the level above, is below this.
+#define QOS_LOAD_HEADROOM 0.4
+// The time constant of the averaged load.
+#define QOS_LOAD_TIME (500 * GST_MSECOND)
+
+// audioresample quality used in low latency mode. Quality 1 uses 16-tap filters, rather than 48 at the default.
+#define LOW_LATENCY_RESAMPLE_QUALITY 1
+// audioresample quality used by the draft profile, with 8-tap filters.
+#define DRAFT_RESAMPLE_QUALITY 0
+// The largest curve and ADAA tables used by the low memory profile.
+#define LOW_MEMORY_TABLE_SIZE 1024
+// The highest oversampling factor that the mastering profile doubles up to. It's the limit of the "oversample" property.
+#define MAX_OVERSAMPLE 64
 
 GST_DEBUG_CATEGORY(GST_CAT_DEFAULT);
 
+typedef enum {
+  BTEDB_DISTORT_MODE_EXACT,
+  BTEDB_DISTORT_MODE_TABLE,
+  BTEDB_DISTORT_MODE_ADAA1,
+  BTEDB_DISTORT_MODE_ADAA2,
+  BTEDB_DISTORT_MODE_POLYNOMIAL
+} BtEdbDistortMode;
+
+typedef enum {
+  // Oversampling is done by the audioresample elements either side of the distort element.
+  BTEDB_DISTORT_OVERSAMPLER_AUDIORESAMPLE,
+  // Oversampling is done by BtEdbOversampler within the distort element, and the audioresample elements pass through.
+  BTEDB_DISTORT_OVERSAMPLER_INTERNAL
+} BtEdbDistortOversampler;
+
+// Sets how quality is traded for speed or memory, on top of the other settings.
+typedef enum {
+  BTEDB_DISTORT_PROFILE_DRAFT,
+  BTEDB_DISTORT_PROFILE_REALTIME,
+  BTEDB_DISTORT_PROFILE_MASTERING,
+  BTEDB_DISTORT_PROFILE_LOW_MEMORY
+} BtEdbDistortProfile;
+
+/*
+  A consistent set of curve params, with everything that the streaming thread needs that's derived from them. Each
+  snapshot holds a reference to the latest tables, which may still be those for earlier params until new ones are
+  built, or NULL before the first.
+ */
+typedef struct {
+  BtEdbDistortParams params;
+  // Chosen to suit the params.
+  BtEdbDistortKernel kernel;
+  // Linear gains, without steps.
+  BtEdbGainRamp gains;
+  BtEdbCurveTable* table;
+  BtEdbAdaaTable* adaa_table;
+  BtEdbPolynomial* polynomial;
+} ParamsSnapshot;
+
 G_DECLARE_FINAL_TYPE(BtEdbDistortInternal, btedb_distort_internal, BTEDB, DISTORT_INTERNAL, GstBaseTransform);
 G_DECLARE_FINAL_TYPE(BtEdbDistort, btedb_distort, BTEDB, DISTORT, GstBin);
 
@@ -44,20 +152,92 @@ struct _BtEdbDistortInternal {
   GstElement* resample_out;
 
   guint oversample;
-  gfloat pos_db_pregain;
-  gfloat pos_shape_a;
-  gfloat pos_shape_b;
-  gfloat pos_shape_exp;
-  gboolean symmetric;
-  gfloat neg_db_pregain;
-  gfloat neg_shape_a;
-  gfloat neg_shape_b;
-  gfloat neg_shape_exp;
-  gfloat db_postgain;
-  
-  gint perf_samples;
-  gulong perf_time;
-  GstClockTime perf_log_time;
+  BtEdbDistortOversampler oversampler_type;
+  gboolean low_latency;
+  /*
+    Params and tables are published here whenever either changes. The streaming thread takes a snapshot at the start
+    of each block, so it never waits for a writer or sees a half-written set.
+  */
+  BtEdbTripleBuffer params_buffer;
+  ParamsSnapshot params_slots[3];
+  BtEdbDistortMode mode;
+  guint table_size;
+  BtEdbInterp table_interp;
+  guint threads;
+  // Whether internal oversampling and distortion run as a pipeline on threads of their own.
+  gboolean pipelined;
+  // Whether the QoS governor may lower quality.
+  gboolean qos;
+  BtEdbDistortProfile profile;
+
+  /*
+    Guarded by publish_lock, which also allows only one thread at a time to publish params. Tables are built by
+    table_pool and swapped in here when done, then published with the params last published.
+  */
+  GMutex publish_lock;
+  BtEdbDistortParams published_params;
+  BtEdbCurveTable* table;
+  BtEdbAdaaTable* adaa_table;
+  BtEdbPolynomial* polynomial;
+  gint table_generation;
+  /*
+    The oversampling factor that suits "polynomial", or 0 before there is one, or if it's too far from the curve to be
+    used. It's also read atomically.
+  */
+  gint polynomial_oversample;
+
+  // These are only used on the streaming thread.
+  GstAudioInfo info;
+  BtEdbSampleFormat format;
+  // The oversampler type that was in effect when caps were negotiated.
+  BtEdbDistortOversampler active_oversampler_type;
+  // The audioresample factor that was in effect when caps were negotiated, which stays until the next negotiation.
+  guint active_resample_oversample;
+  BtEdbOversampler* oversampler;
+  BtEdbPipeline* pipeline;
+  // Frames per control interval, at the negotiated rate.
+  guint control_interval;
+  // The params snapshot for the current block.
+  const ParamsSnapshot* snapshot;
+  // The gains at the start of the next block, with steps per frame. Each block ramps to the gains in params.
+  BtEdbGainRamp gains;
+  // The gains that "gains" is ramping towards.
+  BtEdbGainRamp gains_target;
+  gboolean gains_valid;
+  BtEdbWorkers* workers;
+  // The previous inputs of each channel, for the ADAA modes.
+  BtEdbAdaaState* adaa_state;
+  // Frames of silent input since the last signal.
+  guint64 silent_frames;
+  // The last HISTORY_FRAMES frames of input to each channel, oldest first, with internal oversampling.
+  gfloat* history;
+  // Output buffers for read-only input, and the size of each.
+  GstBufferPool* pool;
+  gsize pool_buffer_size;
+
+  // Guarded by the object lock. The rates are those of the negotiated stream, and of the stream outside the bin.
+  gint rate;
+  gint base_rate;
+  // The latency added by this element, and the estimated total latency of the audioresample elements.
+  GstClockTime latency;
+  GstClockTime resample_latency;
+  // The rate that the curve is applied at, including internal oversampling.
+  gint processing_rate;
+  BtEdbStats stats;
+  // Read-only buffers that were distorted into a pooled buffer, rather than copied and then distorted.
+  guint64 copies_avoided;
+
+  // The QoS governor's level, which is 0 for full quality. It's read atomically by other threads.
+  gint qos_level;
+  // Guarded by the object lock. Set when a QoS event says that a buffer was late.
+  gboolean qos_late;
+  // These are only used on the streaming thread. Times are of audio processed.
+  gdouble qos_load;
+  GstClockTime qos_time;
+  GstClockTime qos_changed_time;
+  GstClockTime qos_behind_time;
+  GstClockTime qos_recover_hold;
+  gboolean qos_restored;
 };
 
 G_DEFINE_TYPE(BtEdbDistortInternal, btedb_distort_internal, GST_TYPE_BASE_TRANSFORM);
@@ -69,14 +249,99 @@ struct _BtEdbDistort {
   GstElement* resample_in;
   GstElement* resample_out;
   BtEdbPropertiesSimple* props;
+  // The curve params, as set by properties. Guarded by params_lock, which also allows only one writer at a time.
+  BtEdbDistortParams params;
+  GMutex params_lock;
+  // The quality and filter mode last applied to resample_in and resample_out.
+  guint resample_quality;
+  GstAudioResamplerFilterMode resample_filter_mode;
+  // The oversampler that was last negotiated or asked for.
+  BtEdbDistortOversampler negotiated_oversampler_type;
+  // The effective mode that latency was last calculated for.
+  BtEdbDistortMode latency_mode;
 
   GstBtUiCustomGfxResponse gfx;
   guint32 gfx_data[GFX_WIDTH * GFX_HEIGHT];
+  /*
+    Guarded by the object lock. A copy of the params for the preview to draw, taken as they're set so that drawing
+    never reads the params while the streaming thread is using them. "gfx_dirty" is set when the copy has changed
+    since the last drawing.
+  */
+  BtEdbDistortParams gfx_params;
+  gboolean gfx_dirty;
+  // When "bt-gfx-invalidated" was last emitted, and the source that will emit it next if it's been put off.
+  gint64 gfx_invalidated_time;
+  guint gfx_timeout;
 };
 
 G_DEFINE_TYPE(BtEdbDistort, btedb_distort, GST_TYPE_BIN);
 
 static guint signal_bt_gfx_invalidated;
+static GThreadPool* table_pool;
+static GParamSpec* pspec_latency;
+static GParamSpec* pspec_stats;
+static GParamSpec* pspec_qos_level;
+
+static GType btedb_distort_mode_get_type(void) {
+  static gsize type = 0;
+
+  if (g_once_init_enter(&type)) {
+    static const GEnumValue values[] = {
+      { BTEDB_DISTORT_MODE_EXACT, "Exact", "exact" },
+      { BTEDB_DISTORT_MODE_TABLE, "Table", "table" },
+      { BTEDB_DISTORT_MODE_ADAA1, "ADAA 1st Order", "adaa1" },
+      { BTEDB_DISTORT_MODE_ADAA2, "ADAA 2nd Order", "adaa2" },
+      { BTEDB_DISTORT_MODE_POLYNOMIAL, "Polynomial", "polynomial" },
+      { 0, NULL, NULL }
+    };
+    g_once_init_leave(&type, g_enum_register_static("BtEdbDistortMode", values));
+  }
+  return type;
+}
+
+static GType btedb_distort_oversampler_get_type(void) {
+  static gsize type = 0;
+
+  if (g_once_init_enter(&type)) {
+    static const GEnumValue values[] = {
+      { BTEDB_DISTORT_OVERSAMPLER_AUDIORESAMPLE, "audioresample", "audioresample" },
+      { BTEDB_DISTORT_OVERSAMPLER_INTERNAL, "Internal", "internal" },
+      { 0, NULL, NULL }
+    };
+    g_once_init_leave(&type, g_enum_register_static("BtEdbDistortOversampler", values));
+  }
+  return type;
+}
+
+static GType btedb_distort_profile_get_type(void) {
+  static gsize type = 0;
+
+  if (g_once_init_enter(&type)) {
+    static const GEnumValue values[] = {
+      { BTEDB_DISTORT_PROFILE_DRAFT, "Draft", "draft" },
+      { BTEDB_DISTORT_PROFILE_REALTIME, "Realtime", "realtime" },
+      { BTEDB_DISTORT_PROFILE_MASTERING, "Mastering", "mastering" },
+      { BTEDB_DISTORT_PROFILE_LOW_MEMORY, "Low Memory", "low-memory" },
+      { 0, NULL, NULL }
+    };
+    g_once_init_leave(&type, g_enum_register_static("BtEdbDistortProfile", values));
+  }
+  return type;
+}
+
+static GType btedb_interp_get_type(void) {
+  static gsize type = 0;
+
+  if (g_once_init_enter(&type)) {
+    static const GEnumValue values[] = {
+      { BTEDB_INTERP_LINEAR, "Linear", "linear" },
+      { BTEDB_INTERP_CUBIC, "Cubic", "cubic" },
+      { 0, NULL, NULL }
+    };
+    g_once_init_leave(&type, g_enum_register_static("BtEdbInterp", values));
+  }
+  return type;
+}
 
 static gboolean plugin_init(GstPlugin* plugin) {
   GST_DEBUG_CATEGORY_INIT(
@@ -85,6 +350,9 @@ static gboolean plugin_init(GstPlugin* plugin) {
     GST_DEBUG_FG_WHITE | GST_DEBUG_BG_BLACK,
     GST_MACHINE_DESC);
 
+  btedb_kernel_init();
+  GST_INFO("using %s distortion kernel", btedb_kernel_name());
+
   return gst_element_register(
     plugin,
     G_STRINGIFY(GST_MACHINE_NAME),
@@ -103,8 +371,9 @@ static GstStaticPadTemplate src_template = GST_STATIC_PAD_TEMPLATE ("src",
     GST_PAD_SRC,
     GST_PAD_ALWAYS,
     GST_STATIC_CAPS ("audio/x-raw, "
-        "format = (string) " GST_AUDIO_NE (F32) ", "
-        "layout = (string) interleaved, "
+        "format = (string) { " GST_AUDIO_NE (F32) ", " GST_AUDIO_NE (F64) ", "
+        GST_AUDIO_NE (S16) ", " GST_AUDIO_NE (S32) " }, "
+        "layout = (string) { interleaved, non-interleaved }, "
         "rate = (int) [1, MAX], "
         "channels = (int) [1, MAX]")
     );
@@ -113,42 +382,548 @@ static GstStaticPadTemplate sink_template = GST_STATIC_PAD_TEMPLATE ("sink",
     GST_PAD_SINK,
     GST_PAD_ALWAYS,
     GST_STATIC_CAPS ("audio/x-raw, "
-        "format = (string) " GST_AUDIO_NE (F32) ", "
-        "layout = (string) interleaved, "
+        "format = (string) { " GST_AUDIO_NE (F32) ", " GST_AUDIO_NE (F64) ", "
+        GST_AUDIO_NE (S16) ", " GST_AUDIO_NE (S32) " }, "
+        "layout = (string) { interleaved, non-interleaved }, "
         "rate = (int) [1, MAX], "
         "channels = (int) [1, MAX]")
     );
 
-static gfloat db_to_gain(gfloat db) {
-  return powf(10.0f, db / 20.0f);
+static inline gboolean mode_is_adaa(BtEdbDistortMode mode) {
+  return mode == BTEDB_DISTORT_MODE_ADAA1 || mode == BTEDB_DISTORT_MODE_ADAA2;
 }
 
-static inline gfloat plerp(gfloat a, gfloat b, gfloat alpha, gfloat power) {
-  return powf(a + (b-a) * MAX(MIN(alpha,1),0), power);
+static inline guint adaa_order(BtEdbDistortMode mode) {
+  return mode == BTEDB_DISTORT_MODE_ADAA2 ? 2 : 1;
 }
 
-static inline void distort(BtEdbDistortInternal* const self, gfloat* data, guint nsamples) {
-  const gfloat pos_pregain = db_to_gain(self->pos_db_pregain);
-  const gfloat neg_pregain = db_to_gain(self->neg_db_pregain);
-  const gfloat postgain = db_to_gain(self->db_postgain);
+// The mode asked for by the "mode" property and the profile. Drafts use the table rather than the exact curve, and
+// mastering does the opposite.
+static inline BtEdbDistortMode profile_mode(const BtEdbDistortInternal* const self) {
+  const BtEdbDistortMode mode = self->mode;
+  if (self->profile == BTEDB_DISTORT_PROFILE_DRAFT && mode == BTEDB_DISTORT_MODE_EXACT)
+    return BTEDB_DISTORT_MODE_TABLE;
+  if (self->profile == BTEDB_DISTORT_PROFILE_MASTERING && mode == BTEDB_DISTORT_MODE_TABLE)
+    return BTEDB_DISTORT_MODE_EXACT;
+  return mode;
+}
 
-  for (int i = 0; i < nsamples; i++) {
-    const gboolean negative = data[i] < 0;
-    const gboolean use_pos_values = self->symmetric || !negative;
-    const gfloat shape0 = use_pos_values ? self->pos_shape_a : self->neg_shape_a;
-    const gfloat shape1 = use_pos_values ? self->pos_shape_b : self->neg_shape_b;
-    const gfloat shape_exp = use_pos_values ? self->pos_shape_exp : self->neg_shape_exp;
-    const gfloat pregain = use_pos_values ? pos_pregain : neg_pregain;
+// The mode in effect, which the QoS governor may have made cheaper than the profile's mode.
+static inline BtEdbDistortMode effective_mode(const BtEdbDistortInternal* const self) {
+  const BtEdbDistortMode mode = profile_mode(self);
+  return mode == BTEDB_DISTORT_MODE_EXACT && g_atomic_int_get(&self->qos_level) > 0 ?
+    BTEDB_DISTORT_MODE_TABLE : mode;
+}
 
-    const gfloat data_abs = fabs(data[i]);
-    data[i] = (1-exp(-fabs(data_abs * pregain)/plerp(shape0, shape1, data_abs, shape_exp))) * postgain;
+// Applies the profile to an oversampling factor. Drafts make do with 2x at most, and mastering doubles the factor.
+static guint profile_oversample(const BtEdbDistortInternal* const self, guint factor) {
+  switch (self->profile) {
+  case BTEDB_DISTORT_PROFILE_DRAFT:
+    return MIN(factor, 2);
+  case BTEDB_DISTORT_PROFILE_MASTERING:
+    return MIN(factor * 2, MAX_OVERSAMPLE);
+  default:
+    return factor;
+  }
+}
+
+/*
+  The oversampler to negotiate caps for. Polynomial mode always uses the internal one, which follows the factor that
+  suits each polynomial as it's fitted, without renegotiating.
+ */
+static BtEdbDistortOversampler requested_oversampler_type(const BtEdbDistortInternal* const self) {
+  return self->mode == BTEDB_DISTORT_MODE_POLYNOMIAL ? BTEDB_DISTORT_OVERSAMPLER_INTERNAL : self->oversampler_type;
+}
+
+// The oversampling factor used with audioresample.
+static guint resample_oversample(const BtEdbDistortInternal* const self) {
+  return profile_oversample(self, self->oversample);
+}
 
-    if (negative)
-      data[i] *= -1;
+/*
+  The internal oversampling factor for the current settings. In polynomial mode, that's the factor that suits the
+  polynomial, rather than the "oversample" property, unless the exact curve is used instead.
+ */
+static guint requested_oversample(const BtEdbDistortInternal* const self) {
+  const gint polynomial_oversample = g_atomic_int_get(&self->polynomial_oversample);
+  const guint factor = self->mode == BTEDB_DISTORT_MODE_POLYNOMIAL && polynomial_oversample > 0 ?
+    (guint)polynomial_oversample : self->oversample;
+  return btedb_oversampler_round_factor(profile_oversample(self, factor));
+}
+
+// The internal oversampling factor in effect, after any halving by the QoS governor.
+static guint effective_oversample(const BtEdbDistortInternal* const self) {
+  guint level = g_atomic_int_get(&self->qos_level);
+  if (profile_mode(self) == BTEDB_DISTORT_MODE_EXACT && level > 0)
+    level--;
+  return MAX(requested_oversample(self) >> level, 1);
+}
+
+// The size of curve and ADAA tables, which the low memory profile keeps small.
+static guint effective_table_size(const BtEdbDistortInternal* const self) {
+  return self->profile == BTEDB_DISTORT_PROFILE_LOW_MEMORY ? MIN(self->table_size, LOW_MEMORY_TABLE_SIZE) :
+    self->table_size;
+}
+
+/*
+  Computes the exact curve in double precision, for the mastering profile, as is done for 64-bit float streams. It's
+  slower than the float kernels, but doesn't round at every step.
+ */
+static void distort_f64(
+  const ParamsSnapshot* const snapshot, const BtEdbGainRamp* const gains, gfloat* data, guint nsamples) {
+
+  gdouble block[CONVERT_SAMPLES];
+  BtEdbGainRamp block_gains = *gains;
+
+  for (guint done = 0; done < nsamples; done += CONVERT_SAMPLES) {
+    const guint n = MIN(CONVERT_SAMPLES, nsamples - done);
+
+    for (guint i = 0; i < n; ++i) {
+      block[i] = data[done + i];
+    }
+    btedb_kernel_f64(&snapshot->params, &block_gains, block, n);
+    for (guint i = 0; i < n; ++i) {
+      data[done + i] = (gfloat)block[i];
+    }
+
+    btedb_gain_ramp_advance(&block_gains, n);
+  }
+}
+
+/*
+  "adaa" is the state of the channel that the samples belong to, which the ADAA modes need. Without it, as when
+  drawing the curve, the ADAA modes compute the curve directly.
+ */
+static inline void distort(
+  BtEdbDistortInternal* const self, const ParamsSnapshot* const snapshot, const BtEdbGainRamp* const gains,
+  BtEdbAdaaState* const adaa, gfloat* data, guint nsamples) {
+
+  const BtEdbDistortMode mode = effective_mode(self);
+
+  if (adaa && mode_is_adaa(mode)) {
+    if (snapshot->adaa_table) {
+      btedb_adaa_process(snapshot->adaa_table, adaa_order(mode), adaa, data, 1, nsamples);
+      return;
+    }
+
+    // Until the first table is ready, the state is kept up to date so that there's no click when it arrives.
+    if (nsamples >= 2) {
+      adaa->x2 = data[nsamples - 2];
+      adaa->x1 = data[nsamples - 1];
+    } else if (nsamples == 1) {
+      adaa->x2 = adaa->x1;
+      adaa->x1 = data[0];
+    }
+  } else if (mode == BTEDB_DISTORT_MODE_TABLE) {
+    // Until the first table is ready, the curve is computed directly.
+    if (snapshot->table) {
+      btedb_curve_table_process(snapshot->table, data, nsamples);
+      return;
+    }
+  } else if (mode == BTEDB_DISTORT_MODE_POLYNOMIAL) {
+    /*
+      As with tables, the curve is computed directly until the first polynomial is ready. So is a curve that no
+      polynomial of the highest degree can follow closely, at the "oversample" factor.
+    */
+    if (snapshot->polynomial && btedb_polynomial_is_accurate(snapshot->polynomial)) {
+      btedb_polynomial_process(snapshot->polynomial, data, nsamples);
+      return;
+    }
+  }
+
+  if (mode == BTEDB_DISTORT_MODE_EXACT && self->profile == BTEDB_DISTORT_PROFILE_MASTERING)
+    distort_f64(snapshot, gains, data, nsamples);
+  else
+    snapshot->kernel(&snapshot->params, gains, data, nsamples);
+}
+
+typedef struct {
+  BtEdbDistortInternal* self;
+  // Per oversampled sample, and advanced after each callback.
+  BtEdbGainRamp gains;
+  BtEdbAdaaState* adaa;
+} OversampledContext;
+
+static void distort_oversampled(gpointer user_data, gfloat* data, guint nsamples) {
+  OversampledContext* const context = (OversampledContext*)user_data;
+  distort(context->self, context->self->snapshot, &context->gains, context->adaa, data, nsamples);
+  btedb_gain_ramp_advance(&context->gains, nsamples);
+}
+
+// Converts a ramp with steps per frame to one with steps per sample.
+static BtEdbGainRamp gains_per_sample(const BtEdbGainRamp* const gains, guint samples_per_frame) {
+  BtEdbGainRamp result = *gains;
+  result.pos_pregain_step /= samples_per_frame;
+  result.neg_pregain_step /= samples_per_frame;
+  result.postgain_step /= samples_per_frame;
+  return result;
+}
+
+/*
+  Sets up the gains to ramp to those of the current snapshot over the next "nframes" frames.
+ */
+static void gains_ramp(BtEdbDistortInternal* const self, guint nframes) {
+  const BtEdbGainRamp* const target = &self->snapshot->gains;
+
+  if (!self->gains_valid) {
+    self->gains_target = *target;
+    self->gains = self->gains_target;
+    self->gains_valid = TRUE;
+  } else if (target->pos_pregain != self->gains_target.pos_pregain ||
+             target->neg_pregain != self->gains_target.neg_pregain ||
+             target->postgain != self->gains_target.postgain) {
+    self->gains_target = *target;
+    btedb_gain_ramp_to(&self->gains, &self->gains_target, nframes);
+  } else {
+    // The previous ramp has ended, so hold at its target.
+    self->gains = self->gains_target;
+  }
+}
+
+/*
+  "channels" has the address of each channel's first sample in the buffer, and consecutive samples of a channel are
+  "stride" samples apart. For interleaved audio, the stride is the channel count, and for non-interleaved audio it's 1.
+  "sources" is laid out the same way, and is where the input is read from. It's the same as "channels" when the buffer
+  is distorted in place.
+ */
+typedef struct {
+  BtEdbDistortInternal* self;
+  guint8* const* sources;
+  guint8* const* channels;
+  guint sample_size;
+  guint stride;
+  guint offset;
+  guint nframes;
+  guint njobs;
+  // True if the block is split by channel for the ADAA modes. It's decided once per block, as the mode may change.
+  gboolean adaa;
+} BlockJob;
+
+static inline gpointer job_sample(const BlockJob* const job, guint channel, guint frame) {
+  return job->channels[channel] + (gsize)(job->offset + frame) * job->stride * job->sample_size;
+}
+
+static inline gpointer job_source(const BlockJob* const job, guint channel, guint frame) {
+  return job->sources[channel] + (gsize)(job->offset + frame) * job->stride * job->sample_size;
+}
+
+/*
+  Distorts samples that are in the stream's format, "stride" samples apart, from "src" into "data". Contiguous 32-bit
+  floats and, in exact mode, 64-bit floats are processed where they are if "src" and "data" are the same. Otherwise,
+  samples are converted to contiguous floats a block at a time, which also copies them.
+ */
+static void distort_native(
+  BtEdbDistortInternal* const self, const BtEdbGainRamp* const gains, BtEdbAdaaState* const adaa, gconstpointer src,
+  gpointer data, guint stride, guint nsamples) {
+
+  const gboolean in_place = src == data;
+
+  if (self->format == BTEDB_SAMPLE_F32 && stride == 1 && in_place) {
+    distort(self, self->snapshot, gains, adaa, (gfloat*)data, nsamples);
+  } else if (self->format == BTEDB_SAMPLE_F64 && effective_mode(self) == BTEDB_DISTORT_MODE_EXACT && stride == 1) {
+    // Converting would lose the extra precision.
+    if (!in_place)
+      memcpy(data, src, nsamples * sizeof(gdouble));
+    btedb_kernel_f64(&self->snapshot->params, gains, (gdouble*)data, nsamples);
+  } else {
+    const guint size = btedb_sample_format_size(self->format);
+    gfloat block[CONVERT_SAMPLES];
+    BtEdbGainRamp block_gains = *gains;
+
+    for (guint done = 0; done < nsamples; done += CONVERT_SAMPLES) {
+      const guint n = MIN(CONVERT_SAMPLES, nsamples - done);
+      const gsize offset = (gsize)done * stride * size;
+
+      btedb_samples_to_float(self->format, (const guint8*)src + offset, stride, block, n);
+      distort(self, self->snapshot, &block_gains, adaa, block, n);
+      btedb_samples_from_float(self->format, block, (guint8*)data + offset, stride, n);
+
+      btedb_gain_ramp_advance(&block_gains, n);
+    }
   }
 }
 
+/*
+  Distorts part of a block. With internal oversampling or in the ADAA modes, each part is a range of channels, as each
+  channel has its own state. Otherwise, each part is a range of frames in every channel.
+ */
+static void process_block_part(gpointer user_data, guint index) {
+  const BlockJob* const job = (BlockJob*)user_data;
+  BtEdbDistortInternal* const self = job->self;
+  const guint channels = GST_AUDIO_INFO_CHANNELS(&self->info);
+  const BtEdbFpMode fp_mode = btedb_denormals_disable();
+
+  if (self->active_oversampler_type == BTEDB_DISTORT_OVERSAMPLER_INTERNAL) {
+    const guint factor = btedb_oversampler_get_factor(self->oversampler);
+    const guint first = index * channels / job->njobs;
+    const guint last = (index + 1) * channels / job->njobs;
+    OversampledContext context = { self };
+
+    for (guint c = first; c < last; ++c) {
+      context.gains = gains_per_sample(&self->gains, factor);
+      context.adaa = &self->adaa_state[c];
+
+      if (self->format == BTEDB_SAMPLE_F32) {
+        btedb_oversampler_process_to(
+          self->oversampler, c, job_source(job, c, 0), job_sample(job, c, 0), job->stride, job->nframes,
+          distort_oversampled, &context);
+      } else {
+        gfloat block[CONVERT_SAMPLES];
+
+        for (guint done = 0; done < job->nframes; done += CONVERT_SAMPLES) {
+          const guint n = MIN(CONVERT_SAMPLES, job->nframes - done);
+
+          btedb_samples_to_float(self->format, job_source(job, c, done), job->stride, block, n);
+          btedb_oversampler_process(self->oversampler, c, block, 1, n, distort_oversampled, &context);
+          btedb_samples_from_float(self->format, block, job_sample(job, c, done), job->stride, n);
+        }
+      }
+    }
+  } else if (job->adaa) {
+    const guint first = index * channels / job->njobs;
+    const guint last = (index + 1) * channels / job->njobs;
+
+    for (guint c = first; c < last; ++c) {
+      distort_native(
+        self, &self->gains, &self->adaa_state[c], job_source(job, c, 0), job_sample(job, c, 0), job->stride,
+        job->nframes);
+    }
+  } else {
+    const guint first = index * job->nframes / job->njobs;
+    const guint last = (index + 1) * job->nframes / job->njobs;
+
+    BtEdbGainRamp gains = self->gains;
+    btedb_gain_ramp_advance(&gains, first);
+
+    if (job->stride == 1) {
+      for (guint c = 0; c < channels; ++c) {
+        distort_native(self, &gains, NULL, job_source(job, c, first), job_sample(job, c, first), 1, last - first);
+      }
+    } else {
+      // Stepping per sample rather than per frame puts each channel a fraction of a step apart, which is inaudible.
+      gains = gains_per_sample(&gains, channels);
+      distort_native(
+        self, &gains, NULL, job_source(job, 0, first), job_sample(job, 0, first), 1, (last - first) * channels);
+    }
+  }
+
+  btedb_denormals_restore(fp_mode);
+}
+
+/*
+  Distorts "nframes" frames starting at "offset", and moves the gains on to the next block.
+ */
+static void process_block(
+  BtEdbDistortInternal* const self, guint8* const* sources, guint8* const* channel_data, guint stride, guint offset,
+  guint nframes) {
+  const guint channels = GST_AUDIO_INFO_CHANNELS(&self->info);
+  const gboolean internal = self->active_oversampler_type == BTEDB_DISTORT_OVERSAMPLER_INTERNAL;
+  const guint factor = internal ? btedb_oversampler_get_factor(self->oversampler) : 1;
+
+  const gboolean adaa = mode_is_adaa(effective_mode(self));
+
+  guint njobs = MIN(btedb_workers_get_threads(self->workers), nframes * channels * factor / PARALLEL_MIN_SAMPLES);
+  if (internal || adaa)
+    njobs = MIN(njobs, channels);
+
+  const guint sample_size = btedb_sample_format_size(self->format);
+  BlockJob job = { self, sources, channel_data, sample_size, stride, offset, nframes, MAX(njobs, 1), adaa };
+  btedb_workers_run(self->workers, job.njobs, process_block_part, &job);
+
+  btedb_gain_ramp_advance(&self->gains, nframes);
+}
+
+// Sets up everything derived from "params". The tables are left alone.
+static void params_snapshot_init(ParamsSnapshot* const snapshot, const BtEdbDistortParams* const params) {
+  snapshot->params = *params;
+  snapshot->kernel = btedb_kernel_select(params);
+  btedb_gain_ramp_init(&snapshot->gains, params);
+}
+
+// Releases the snapshot's tables.
+static void params_snapshot_clear(ParamsSnapshot* const snapshot) {
+  g_clear_pointer(&snapshot->table, btedb_curve_table_unref);
+  g_clear_pointer(&snapshot->adaa_table, btedb_adaa_table_unref);
+  g_clear_pointer(&snapshot->polynomial, btedb_polynomial_unref);
+}
+
+// Copies "src" over "dest", which keeps its own references to the tables, and releases those that "dest" held.
+static void params_snapshot_copy(ParamsSnapshot* const dest, const ParamsSnapshot* const src) {
+  params_snapshot_clear(dest);
+  *dest = *src;
+  if (dest->table)
+    btedb_curve_table_ref(dest->table);
+  if (dest->adaa_table)
+    btedb_adaa_table_ref(dest->adaa_table);
+  if (dest->polynomial)
+    btedb_polynomial_ref(dest->polynomial);
+}
+
+/*
+  Publishes "published_params" and the latest tables to the streaming thread. The streaming thread never reads the
+  back slot, so whatever it held from an earlier publish can be released here. Called with publish_lock held.
+ */
+static void params_publish_locked(BtEdbDistortInternal* const self) {
+  ParamsSnapshot* const snapshot = btedb_triple_buffer_back(&self->params_buffer);
+  params_snapshot_clear(snapshot);
+  params_snapshot_init(snapshot, &self->published_params);
+  snapshot->table = self->table ? btedb_curve_table_ref(self->table) : NULL;
+  snapshot->adaa_table = self->adaa_table ? btedb_adaa_table_ref(self->adaa_table) : NULL;
+  snapshot->polynomial = self->polynomial ? btedb_polynomial_ref(self->polynomial) : NULL;
+  btedb_triple_buffer_publish(&self->params_buffer);
+}
+
+static void params_publish(BtEdbDistortInternal* const self, const BtEdbDistortParams* const params) {
+  g_mutex_lock(&self->publish_lock);
+  self->published_params = *params;
+  params_publish_locked(self);
+  g_mutex_unlock(&self->publish_lock);
+}
+
+typedef enum {
+  TABLE_CURVE,
+  TABLE_ADAA,
+  TABLE_POLYNOMIAL
+} TableKind;
+
+typedef struct {
+  BtEdbDistortInternal* self;
+  TableKind kind;
+  BtEdbDistortParams params;
+  guint size;
+  BtEdbInterp interp;
+  gint generation;
+} TableJob;
+
+static void table_pool_func(gpointer data, gpointer user_data) {
+  TableJob* const job = (TableJob*)data;
+  BtEdbDistortInternal* const self = job->self;
+
+  // If more properties have changed since this job was queued, then there's no point building this table.
+  if (job->generation == g_atomic_int_get(&self->table_generation)) {
+    if (job->kind == TABLE_ADAA) {
+      BtEdbAdaaTable* table = btedb_adaa_table_new(&job->params, job->size);
+
+      g_mutex_lock(&self->publish_lock);
+      if (job->generation == self->table_generation) {
+        BtEdbAdaaTable* const old = self->adaa_table;
+        self->adaa_table = table;
+        table = old;
+        params_publish_locked(self);
+      }
+      g_mutex_unlock(&self->publish_lock);
+
+      if (table)
+        btedb_adaa_table_unref(table);
+    } else if (job->kind == TABLE_POLYNOMIAL) {
+      BtEdbPolynomial* polynomial = btedb_polynomial_new(&job->params);
+
+      GST_DEBUG_OBJECT(self, "fitted a polynomial of degree %u, error %g, for %ux oversampling",
+                       btedb_polynomial_get_degree(polynomial), btedb_polynomial_get_error(polynomial),
+                       btedb_polynomial_get_oversample(polynomial));
+
+      g_mutex_lock(&self->publish_lock);
+      if (job->generation == self->table_generation) {
+        BtEdbPolynomial* const old = self->polynomial;
+        self->polynomial = polynomial;
+        g_atomic_int_set(
+          &self->polynomial_oversample,
+          btedb_polynomial_is_accurate(polynomial) ? btedb_polynomial_get_oversample(polynomial) : 0);
+        polynomial = old;
+        params_publish_locked(self);
+      }
+      g_mutex_unlock(&self->publish_lock);
+
+      if (polynomial)
+        btedb_polynomial_unref(polynomial);
+    } else {
+      BtEdbCurveTable* table = btedb_curve_table_new(&job->params, job->size, job->interp);
+
+      g_mutex_lock(&self->publish_lock);
+      if (job->generation == self->table_generation) {
+        BtEdbCurveTable* const old = self->table;
+        self->table = table;
+        table = old;
+        params_publish_locked(self);
+      }
+      g_mutex_unlock(&self->publish_lock);
+
+      if (table)
+        btedb_curve_table_unref(table);
+    }
+  }
+
+  gst_object_unref(self);
+  g_free(job);
+}
+
+/*
+  Queues a rebuild of the curve table, ADAA table or polynomial for "params", if the mode uses one and it's out of
+  date. Building is done in table_pool so that property changes don't stall the caller, which may be the streaming
+  thread when properties are being automated.
+ */
+static void table_request(BtEdbDistortInternal* const self, const BtEdbDistortParams* const params) {
+  const BtEdbDistortMode mode = effective_mode(self);
+  TableKind kind;
+  /*
+    With QoS on, the exact curve keeps a curve table ready, so the governor can switch to it straight away without
+    asking for one from the streaming thread.
+  */
+  if (mode == BTEDB_DISTORT_MODE_TABLE || (mode == BTEDB_DISTORT_MODE_EXACT && self->qos))
+    kind = TABLE_CURVE;
+  else if (mode_is_adaa(mode))
+    kind = TABLE_ADAA;
+  else if (mode == BTEDB_DISTORT_MODE_POLYNOMIAL)
+    kind = TABLE_POLYNOMIAL;
+  else
+    return;
+
+  const guint size = effective_table_size(self);
+
+  g_mutex_lock(&self->publish_lock);
+  gboolean current;
+  switch (kind) {
+  case TABLE_ADAA:
+    current = self->adaa_table && btedb_adaa_table_matches(self->adaa_table, params, size);
+    break;
+  case TABLE_POLYNOMIAL:
+    current = self->polynomial && btedb_polynomial_matches(self->polynomial, params);
+    break;
+  default:
+    current = self->table && btedb_curve_table_matches(self->table, params, size, self->table_interp);
+    break;
+  }
+  if (current) {
+    g_mutex_unlock(&self->publish_lock);
+    return;
+  }
+
+  TableJob* const job = g_new(TableJob, 1);
+  job->self = gst_object_ref(self);
+  job->kind = kind;
+  job->params = *params;
+  job->size = size;
+  job->interp = self->table_interp;
+  job->generation = ++self->table_generation;
+  g_mutex_unlock(&self->publish_lock);
+
+  g_thread_pool_push(table_pool, job, NULL);
+}
+
+/*
+  Only the params that were copied for the preview are used, so the curve is always drawn exactly. It's only redrawn
+  if they've changed since the last request.
+ */
 static const GstBtUiCustomGfxResponse* on_gfx_request(BtEdbDistort* self) {
+  GST_OBJECT_LOCK(self);
+  const BtEdbDistortParams params = self->gfx_params;
+  const gboolean dirty = self->gfx_dirty;
+  self->gfx_dirty = FALSE;
+  GST_OBJECT_UNLOCK(self);
+
+  if (!dirty)
+    return &self->gfx;
+
   gfloat data_in[GFX_WIDTH];
   guint32* const gfx = self->gfx.data;
 
@@ -160,8 +935,8 @@ static const GstBtUiCustomGfxResponse* on_gfx_request(BtEdbDistort* self) {
     data_in[i] = -1.0f + 2 * ((gfloat)i/GFX_WIDTH);
   }
 
-  distort(self->distort, data_in, GFX_WIDTH);
-  
+  btedb_distort(&params, data_in, GFX_WIDTH);
+
   for (int i = 1; i < GFX_WIDTH; ++i) {
     const gfloat val0 = 1.0f - ((data_in[i-1] + 1) / 2);
     const gfloat val1 = 1.0f - ((data_in[i] + 1) / 2);
@@ -175,53 +950,905 @@ static const GstBtUiCustomGfxResponse* on_gfx_request(BtEdbDistort* self) {
   return &self->gfx;
 }
 
+// Drafts use the short filters too, as they're cheaper.
+static BtEdbOversamplerQuality oversampler_quality(const BtEdbDistortInternal* const self) {
+  return self->low_latency || self->profile == BTEDB_DISTORT_PROFILE_DRAFT ?
+    BTEDB_OVERSAMPLER_QUALITY_LOW_LATENCY : BTEDB_OVERSAMPLER_QUALITY_HIGH;
+}
+
+static guint resample_quality(const BtEdbDistortInternal* const self) {
+  guint quality;
+  switch (self->profile) {
+  case BTEDB_DISTORT_PROFILE_DRAFT:
+    quality = DRAFT_RESAMPLE_QUALITY;
+    break;
+  case BTEDB_DISTORT_PROFILE_MASTERING:
+    quality = GST_AUDIO_RESAMPLER_QUALITY_MAX;
+    break;
+  default:
+    quality = GST_AUDIO_RESAMPLER_QUALITY_DEFAULT;
+    break;
+  }
+  return self->low_latency ? MIN(quality, LOW_LATENCY_RESAMPLE_QUALITY) : quality;
+}
+
+/*
+  Interpolated filter tables hold fewer filter phases than full ones, and interpolate between them, so they're slower
+  but smaller.
+ */
+static GstAudioResamplerFilterMode resample_filter_mode(const BtEdbDistortInternal* const self) {
+  return self->profile == BTEDB_DISTORT_PROFILE_LOW_MEMORY ?
+    GST_AUDIO_RESAMPLER_FILTER_MODE_INTERPOLATED : GST_AUDIO_RESAMPLER_FILTER_MODE_FULL;
+}
+
+typedef struct {
+  gint in_rate;
+  gint out_rate;
+  guint quality;
+  GstClockTime latency;
+} ResampleLatency;
+
+/*
+  Resampler latencies found so far, shared by every instance. Building a resampler means building its filter tables,
+  and instances in a song mostly run at the same rates, so each latency only needs to be found once.
+*/
+G_LOCK_DEFINE_STATIC(resample_latencies);
+static GArray* resample_latencies;
+
+/*
+  audioresample reports its own latency, but doesn't expose it as a property. It's found here by building a resampler
+  with the same settings as the element uses.
+ */
+static GstClockTime resample_latency(gint in_rate, gint out_rate, guint quality) {
+  G_LOCK(resample_latencies);
+  if (!resample_latencies)
+    resample_latencies = g_array_new(FALSE, FALSE, sizeof(ResampleLatency));
+
+  for (guint i = 0; i < resample_latencies->len; ++i) {
+    const ResampleLatency* const entry = &g_array_index(resample_latencies, ResampleLatency, i);
+    if (entry->in_rate == in_rate && entry->out_rate == out_rate && entry->quality == quality) {
+      const GstClockTime result = entry->latency;
+      G_UNLOCK(resample_latencies);
+      return result;
+    }
+  }
+  G_UNLOCK(resample_latencies);
+
+  GstStructure* const options = gst_structure_new_empty("options");
+  gst_audio_resampler_options_set_quality(GST_AUDIO_RESAMPLER_METHOD_KAISER, quality, in_rate, out_rate, options);
+
+  GstAudioResampler* const resampler = gst_audio_resampler_new(
+    GST_AUDIO_RESAMPLER_METHOD_KAISER, GST_AUDIO_RESAMPLER_FLAG_NONE, GST_AUDIO_FORMAT_F32, 1, in_rate, out_rate,
+    options);
+  gst_structure_free(options);
+
+  if (!resampler)
+    return 0;
+
+  const gsize latency = gst_audio_resampler_get_max_latency(resampler);
+  gst_audio_resampler_free(resampler);
+
+  const ResampleLatency entry = {
+    in_rate, out_rate, quality, gst_util_uint64_scale_int_round(latency, GST_SECOND, in_rate)
+  };
+
+  G_LOCK(resample_latencies);
+  g_array_append_val(resample_latencies, entry);
+  G_UNLOCK(resample_latencies);
+
+  return entry.latency;
+}
+
+/*
+  Recalculates latency after any change to the rate or oversampling settings, and tells the pipeline if it changed.
+ */
+static void update_latency(BtEdbDistortInternal* const self) {
+  GST_OBJECT_LOCK(self);
+  const gint rate = self->rate;
+  const gint base_rate = self->base_rate;
+  GST_OBJECT_UNLOCK(self);
+
+  if (rate <= 0 || base_rate <= 0)
+    return;
+
+  // The mode that's processing, after the profile and the QoS governor have had their say.
+  const BtEdbDistortMode mode = effective_mode(self);
+  // In samples at the negotiated rate.
+  gdouble samples = 0;
+  GstClockTime resample = 0;
+
+  if (self->active_oversampler_type == BTEDB_DISTORT_OVERSAMPLER_INTERNAL) {
+    const guint factor = self->oversampler ? btedb_oversampler_get_factor(self->oversampler) : effective_oversample(self);
+    samples = btedb_oversampler_latency_for(factor, oversampler_quality(self));
+
+    // ADAA runs at the oversampled rate.
+    if (mode_is_adaa(mode))
+      samples += btedb_adaa_latency(adaa_order(mode)) / factor;
+
+    if (self->pipeline)
+      samples += BTEDB_PIPELINE_DELAY_FRAMES;
+  } else {
+    if (rate != base_rate) {
+      const guint quality = resample_quality(self);
+      resample = resample_latency(base_rate, rate, quality) + resample_latency(rate, base_rate, quality);
+    }
+
+    if (mode_is_adaa(mode))
+      samples = btedb_adaa_latency(adaa_order(mode));
+  }
+
+  const GstClockTime latency = (GstClockTime)(samples * GST_SECOND / rate + 0.5);
+
+  GST_OBJECT_LOCK(self);
+  const gboolean changed = latency != self->latency || resample != self->resample_latency;
+  self->latency = latency;
+  self->resample_latency = resample;
+  GST_OBJECT_UNLOCK(self);
+
+  if (changed) {
+    GST_INFO_OBJECT(self, "latency is now %" GST_TIME_FORMAT " + %" GST_TIME_FORMAT " in audioresample",
+                    GST_TIME_ARGS(latency), GST_TIME_ARGS(resample));
+    gst_element_post_message((GstElement*)self, gst_message_new_latency((GstObject*)self));
+  }
+}
+
+/*
+  A snapshot of the processing statistics. Times are in nanoseconds, and "samples" counts samples in every channel at
+  the negotiated rate. "shared-filter-bytes" is for the whole process, rather than this instance.
+ */
+static GstStructure* stats_structure(BtEdbDistortInternal* const self) {
+  GST_OBJECT_LOCK(self);
+  const BtEdbStats* const stats = &self->stats;
+  GstStructure* const result = gst_structure_new(
+    "stats",
+    "buffers", G_TYPE_UINT64, stats->buffers,
+    "samples", G_TYPE_UINT64, stats->samples,
+    "process-time-p50", G_TYPE_UINT64, btedb_stats_percentile(stats, 0.5),
+    "process-time-p99", G_TYPE_UINT64, btedb_stats_percentile(stats, 0.99),
+    "process-time-max", G_TYPE_UINT64, stats->max_process_time,
+    "load", G_TYPE_DOUBLE, btedb_stats_load(stats),
+    "load-max", G_TYPE_DOUBLE, stats->max_load,
+    "processing-rate", G_TYPE_INT, self->processing_rate,
+    "shared-filter-bytes", G_TYPE_UINT64, (guint64)btedb_oversampler_get_shared_bytes(),
+    "copies-avoided", G_TYPE_UINT64, self->copies_avoided,
+    NULL);
+  GST_OBJECT_UNLOCK(self);
+
+  return result;
+}
+
+static gboolean gfx_timeout_func(gpointer user_data) {
+  BtEdbDistort* const self = (BtEdbDistort*)user_data;
+
+  GST_OBJECT_LOCK(self);
+  self->gfx_timeout = 0;
+  self->gfx_invalidated_time = g_get_monotonic_time();
+  GST_OBJECT_UNLOCK(self);
+
+  g_signal_emit(self, signal_bt_gfx_invalidated, 0);
+  return G_SOURCE_REMOVE;
+}
+
+/*
+  Takes a copy of the params for the preview, and returns TRUE if it should be invalidated now. Automation can set
+  properties hundreds of times a second, so invalidations closer together than GFX_MIN_INTERVAL are put off and merged
+  into one, which is emitted from the main loop.
+ */
+static gboolean gfx_params_update(BtEdbDistort* const self) {
+  GST_OBJECT_LOCK(self);
+  if (memcmp(&self->gfx_params, &self->params, sizeof(BtEdbDistortParams)) == 0) {
+    GST_OBJECT_UNLOCK(self);
+    return FALSE;
+  }
+
+  self->gfx_params = self->params;
+  self->gfx_dirty = TRUE;
+
+  gboolean emit = FALSE;
+  if (!self->gfx_timeout) {
+    const gint64 now = g_get_monotonic_time();
+    const gint64 elapsed = now - self->gfx_invalidated_time;
+
+    if (elapsed >= GFX_MIN_INTERVAL) {
+      self->gfx_invalidated_time = now;
+      emit = TRUE;
+    } else {
+      self->gfx_timeout = g_timeout_add_full(
+        G_PRIORITY_DEFAULT, (GFX_MIN_INTERVAL - elapsed + 999) / 1000, gfx_timeout_func, gst_object_ref(self),
+        gst_object_unref);
+    }
+  }
+  GST_OBJECT_UNLOCK(self);
+
+  return emit;
+}
+
 static void set_property (GObject* object, guint prop_id, const GValue* value, GParamSpec* pspec) {
   BtEdbDistort* self = (BtEdbDistort*)object;
   g_assert(self->props);
-  btedb_properties_simple_set(self->props, pspec, value);
 
-  g_signal_emit(self, signal_bt_gfx_invalidated, 0);
+  g_mutex_lock(&self->params_lock);
+  const BtEdbDistortParams old_params = self->params;
+  btedb_properties_simple_set(self->props, prop_id, pspec, value);
+
+  // Everything derived from the params is worked out here, rather than by the streaming thread.
+  if (memcmp(&old_params, &self->params, sizeof(BtEdbDistortParams)) != 0)
+    params_publish(self->distort, &self->params);
+
+  table_request(self->distort, &self->params);
+  const gboolean gfx_invalidated = gfx_params_update(self);
+  g_mutex_unlock(&self->params_lock);
+
+  // Handlers may read properties, so the signal is emitted without the lock held.
+  if (gfx_invalidated)
+    g_signal_emit(self, signal_bt_gfx_invalidated, 0);
+
+  gboolean latency_changed = FALSE;
+
+  const guint quality = resample_quality(self->distort);
+  const GstAudioResamplerFilterMode filter_mode = resample_filter_mode(self->distort);
+  if (quality != self->resample_quality || filter_mode != self->resample_filter_mode) {
+    self->resample_quality = quality;
+    self->resample_filter_mode = filter_mode;
+
+    g_object_set(self->resample_in, "quality", quality, "sinc-filter-mode", filter_mode, NULL);
+    g_object_set(self->resample_out, "quality", quality, "sinc-filter-mode", filter_mode, NULL);
+
+    latency_changed = TRUE;
+  }
+
+  /*
+    The audioresample elements only follow the oversampling settings when caps are negotiated, and renegotiating
+    restarts their filters, which is heard as a dropout. So a change of oversampler asks them to negotiate again, but
+    a change to the audioresample factor waits for the next negotiation, such as when playback is next started. The
+    internal oversampler follows the factor by itself, without a gap.
+  */
+  const BtEdbDistortOversampler oversampler_type = requested_oversampler_type(self->distort);
+  if (oversampler_type != self->negotiated_oversampler_type) {
+    GST_DEBUG_OBJECT(self, "oversampler changed, renegotiating");
+    gst_base_transform_reconfigure_sink((GstBaseTransform*)self->distort);
+  }
+  self->negotiated_oversampler_type = oversampler_type;
+
+  // The ADAA modes add a little latency of their own.
+  const BtEdbDistortMode mode = effective_mode(self->distort);
+  if (mode != self->latency_mode) {
+    self->latency_mode = mode;
+    latency_changed = TRUE;
+  }
+
+  if (latency_changed)
+    update_latency(self->distort);
 }
 
 static void get_property (GObject * object, guint prop_id, GValue * value, GParamSpec * pspec) {
   BtEdbDistort* self = (BtEdbDistort*)object;
-  btedb_properties_simple_get(self->props, pspec, value);
+
+  if (pspec == pspec_latency) {
+    GST_OBJECT_LOCK(self->distort);
+    g_value_set_uint64(value, self->distort->latency + self->distort->resample_latency);
+    GST_OBJECT_UNLOCK(self->distort);
+  } else if (pspec == pspec_stats) {
+    g_value_take_boxed(value, stats_structure(self->distort));
+  } else if (pspec == pspec_qos_level) {
+    g_value_set_uint(value, g_atomic_int_get(&self->distort->qos_level));
+  } else {
+    g_mutex_lock(&self->params_lock);
+    btedb_properties_simple_get(self->props, prop_id, pspec, value);
+    g_mutex_unlock(&self->params_lock);
+  }
 }
 
-static GstFlowReturn transform_ip(GstBaseTransform* baset, GstBuffer* gstbuf) {
+/*
+  True if every sample is zero. Other silent values, such as -0.0, are processed as usual.
+ */
+static gboolean is_silent(const GstAudioBuffer* const abuf, guint bps) {
+  const guint nplanes = GST_AUDIO_BUFFER_N_PLANES(abuf);
+  const gsize size = GST_AUDIO_BUFFER_N_SAMPLES(abuf) * (GST_AUDIO_BUFFER_CHANNELS(abuf) / nplanes) * bps;
+
+  for (guint p = 0; p < nplanes; ++p) {
+    const guint8* const data = (const guint8*)GST_AUDIO_BUFFER_PLANE_DATA(abuf, p);
+
+    // Checked in chunks, so that a buffer with signal is usually rejected quickly.
+    for (gsize start = 0; start < size; start += 4096) {
+      const gsize end = MIN(start + 4096, size);
+      guint8 bits = 0;
+      for (gsize i = start; i < end; ++i) {
+        bits |= data[i];
+      }
+      if (bits)
+        return FALSE;
+    }
+  }
+
+  return TRUE;
+}
+
+/*
+  What the pipeline's distortion thread needs for one block. The snapshot is copied, as the streaming thread will have
+  moved on to others by the time the block is distorted.
+ */
+typedef struct {
+  ParamsSnapshot snapshot;
+  // Per frame, ramping over the block.
+  BtEdbGainRamp gains;
+} PipelineBlock;
+
+static void pipeline_block_clear(gpointer block_data) {
+  params_snapshot_clear(&((PipelineBlock*)block_data)->snapshot);
+}
+
+typedef struct {
+  BtEdbDistortInternal* self;
+  GstObject* bin;
+  // The stream time of the buffer, or GST_CLOCK_TIME_NONE if there's no automation to follow.
+  GstClockTime timestamp;
+} PipelineContext;
+
+/*
+  Starts a block of the pipeline, on the streaming thread. Automation and gain ramps follow the pipeline's blocks, which
+  are the same length as a control interval, rather than buffers.
+ */
+static void pipeline_block(gpointer user_data, gpointer block_data, guint frame) {
+  const PipelineContext* const context = (const PipelineContext*)user_data;
+  BtEdbDistortInternal* const self = context->self;
+  PipelineBlock* const block = (PipelineBlock*)block_data;
+
+  if (GST_CLOCK_TIME_IS_VALID(context->timestamp)) {
+    gst_object_sync_values(
+      context->bin,
+      context->timestamp + gst_util_uint64_scale_int(frame, GST_SECOND, GST_AUDIO_INFO_RATE(&self->info)));
+  }
+
+  self->snapshot = btedb_triple_buffer_read(&self->params_buffer, NULL);
+  gains_ramp(self, BTEDB_PIPELINE_BLOCK_FRAMES);
+  params_snapshot_copy(&block->snapshot, self->snapshot);
+  block->gains = self->gains;
+  btedb_gain_ramp_advance(&self->gains, BTEDB_PIPELINE_BLOCK_FRAMES);
+}
+
+// Distorts one channel of a block, on the pipeline's distortion thread.
+static void pipeline_distort(
+  gpointer user_data, gconstpointer block_data, guint channel, gfloat* data, guint nsamples) {
+  BtEdbDistortInternal* const self = (BtEdbDistortInternal*)user_data;
+  const PipelineBlock* const block = (const PipelineBlock*)block_data;
+  const BtEdbGainRamp gains = gains_per_sample(&block->gains, nsamples / BTEDB_PIPELINE_BLOCK_FRAMES);
+
+  distort(self, &block->snapshot, &gains, &self->adaa_state[channel], data, nsamples);
+}
+
+/*
+  Distorts a whole buffer, following any automation.
+ */
+static void process(
+  BtEdbDistortInternal* const self, GstClockTime pts, guint8* const* sources, guint8* const* channel_data, guint stride,
+  guint nframes) {
+
+  /*
+    The properties belong to the bin, so that's where automation is applied. When it's active, the buffer is split into
+    control intervals so that automation is followed closely however large buffers are.
+  */
+  GstObject* const bin = GST_OBJECT_PARENT(self);
+  const gboolean automated = bin && gst_object_has_active_control_bindings(bin);
+  const GstClockTime timestamp = gst_segment_to_stream_time(&self->parent.segment, GST_FORMAT_TIME, pts);
+
+  if (self->pipeline) {
+    const PipelineContext context = { self, bin, automated ? timestamp : GST_CLOCK_TIME_NONE };
+    btedb_pipeline_process(
+      self->pipeline, sources, channel_data, stride, nframes, pipeline_block, (gpointer)&context);
+    return;
+  }
+
+  const guint threads = self->threads ? self->threads : g_get_num_processors();
+  if (!self->workers || btedb_workers_get_threads(self->workers) != threads) {
+    g_clear_pointer(&self->workers, btedb_workers_free);
+    self->workers = btedb_workers_new(threads);
+  }
+
+  const guint block = automated ? self->control_interval : nframes;
+
+  for (guint done = 0; done < nframes; done += block) {
+    if (automated && GST_CLOCK_TIME_IS_VALID(timestamp)) {
+      gst_object_sync_values(
+        bin, timestamp + gst_util_uint64_scale_int(done, GST_SECOND, GST_AUDIO_INFO_RATE(&self->info)));
+    }
+
+    const guint n = MIN(block, nframes - done);
+    self->snapshot = btedb_triple_buffer_read(&self->params_buffer, NULL);
+    gains_ramp(self, n);
+    process_block(self, sources, channel_data, stride, done, n);
+  }
+}
+
+/*
+  True if a buffer is being finished after the time it's due to be played, going by the pipeline clock. That can only
+  happen when playing in real time, so offline rendering is never made cheaper.
+ */
+static gboolean buffer_late(BtEdbDistortInternal* const self, GstClockTime pts) {
+  if (!self->qos || !GST_CLOCK_TIME_IS_VALID(pts) || GST_STATE(self) != GST_STATE_PLAYING)
+    return FALSE;
+
+  GstClock* const clock = gst_element_get_clock((GstElement*)self);
+  if (!clock)
+    return FALSE;
+  const GstClockTime now = gst_clock_get_time(clock);
+  gst_object_unref(clock);
+
+  const GstClockTime base_time = gst_element_get_base_time((GstElement*)self);
+  const GstClockTime running_time = gst_segment_to_running_time(&self->parent.segment, GST_FORMAT_TIME, pts);
+
+  return GST_CLOCK_TIME_IS_VALID(running_time) && now > base_time && now - base_time > running_time;
+}
+
+// The number of levels that the QoS governor can use with the current settings.
+static gint qos_max_level(const BtEdbDistortInternal* const self) {
+  gint result = profile_mode(self) == BTEDB_DISTORT_MODE_EXACT ? 1 : 0;
+  if (self->active_oversampler_type == BTEDB_DISTORT_OVERSAMPLER_INTERNAL) {
+    for (guint factor = requested_oversample(self); factor > 1; factor >>= 1) {
+      result++;
+    }
+  }
+  return result;
+}
+
+/*
+  Run after each buffer, with the time taken to process it and its duration. Lowers quality if playback is falling
+  behind and this element's load is significant, and restores it once there's been headroom for a while. Changes are
+  announced with a "bt-edb-distort-qos" element message.
+ */
+static void qos_update(BtEdbDistortInternal* const self, GstClockTime pts, guint64 time, guint64 duration) {
+  if (duration == 0)
+    return;
+
+  self->qos_time += duration;
+  const gdouble alpha = MIN(1.0, (gdouble)duration / QOS_LOAD_TIME);
+  self->qos_load += alpha * ((gdouble)time / duration - self->qos_load);
+
+  GST_OBJECT_LOCK(self);
+  gboolean behind = self->qos_late;
+  self->qos_late = FALSE;
+  GST_OBJECT_UNLOCK(self);
+
+  const gint level = g_atomic_int_get(&self->qos_level);
+  const gint max_level = self->qos ? qos_max_level(self) : 0;
+  const GstClockTime since_change = self->qos_time - self->qos_changed_time;
+  gint new_level = MIN(level, max_level);
+
+  /*
+    Reading the clock takes a reference to it, so it's only done when being behind could make a difference: when
+    quality could be lowered, or when it's been lowered and being behind should hold off restoring it.
+  */
+  const gboolean can_lower = self->qos_load >= QOS_LOAD_SIGNIFICANT && new_level < max_level;
+  if (!behind && (can_lower || new_level > 0))
+    behind = buffer_late(self, pts);
+  if (behind)
+    self->qos_behind_time = self->qos_time;
+
+  if (behind && can_lower && since_change >= QOS_STEP_HOLD) {
+    // Falling behind soon after restoring a level means that it doesn't fit yet, so the next wait is longer.
+    if (self->qos_restored && since_change < 2 * self->qos_recover_hold)
+      self->qos_recover_hold = MIN(2 * self->qos_recover_hold, QOS_RECOVER_HOLD_MAX);
+    self->qos_restored = FALSE;
+    new_level++;
+  } else if (!behind && new_level > 0 && since_change >= self->qos_recover_hold &&
+             self->qos_time - self->qos_behind_time >= self->qos_recover_hold &&
+             2 * self->qos_load < QOS_LOAD_HEADROOM) {
+    self->qos_restored = TRUE;
+    new_level--;
+  }
+
+  if (new_level == level)
+    return;
+
+  g_atomic_int_set(&self->qos_level, new_level);
+  self->qos_changed_time = self->qos_time;
+  if (new_level == 0)
+    self->qos_recover_hold = QOS_RECOVER_HOLD;
+
+  // Any table that the new mode needs was built ahead of time by table_request.
+  const BtEdbDistortMode mode = effective_mode(self);
+  const guint oversample = self->active_oversampler_type == BTEDB_DISTORT_OVERSAMPLER_INTERNAL ?
+    effective_oversample(self) : self->active_resample_oversample;
+
+  GST_INFO_OBJECT(self, "QoS level %d, load %f: oversample %u, mode %d", new_level, self->qos_load, oversample, mode);
+
+  gst_element_post_message(
+    (GstElement*)self,
+    gst_message_new_element(
+      (GstObject*)self,
+      gst_structure_new(
+        "bt-edb-distort-qos",
+        "level", G_TYPE_UINT, (guint)new_level,
+        "oversample", G_TYPE_UINT, oversample,
+        "mode", btedb_distort_mode_get_type(), mode,
+        "load", G_TYPE_DOUBLE, self->qos_load,
+        NULL)));
+}
+
+/*
+  QoS events are sent upstream by sinks that sync to the clock, and a positive difference means that a buffer arrived
+  late. They're noted for the governor. QoS isn't enabled on the transform, so late buffers are never dropped, which
+  would be heard as a gap.
+ */
+static gboolean src_event(GstBaseTransform* trans, GstEvent* event) {
+  BtEdbDistortInternal* const self = (BtEdbDistortInternal*)trans;
+
+  if (GST_EVENT_TYPE(event) == GST_EVENT_QOS) {
+    GstQOSType type;
+    gdouble proportion;
+    GstClockTimeDiff diff;
+    GstClockTime timestamp;
+    gst_event_parse_qos(event, &type, &proportion, &diff, &timestamp);
+
+    if (diff > 0) {
+      GST_OBJECT_LOCK(self);
+      self->qos_late = TRUE;
+      GST_OBJECT_UNLOCK(self);
+    }
+  }
+
+  return GST_BASE_TRANSFORM_CLASS(btedb_distort_internal_parent_class)->src_event(trans, event);
+}
+
+/*
+  A new oversampler's filters are clear, which would be heard as a dropout when the factor changes during playback.
+  Running the last few frames of input through it first leaves it as it would be had it been running all along. The
+  output is discarded, and the ADAA state is left alone.
+
+  The last "pending" frames of history are left out, as they're still to be processed by the pipeline.
+ */
+static void oversampler_prime(BtEdbDistortInternal* const self, guint pending) {
+  const guint channels = GST_AUDIO_INFO_CHANNELS(&self->info);
+  const guint factor = btedb_oversampler_get_factor(self->oversampler);
+  const guint nframes = MIN(btedb_oversampler_get_tail(self->oversampler), HISTORY_FRAMES - pending);
+  const BtEdbFpMode fp_mode = btedb_denormals_disable();
+  gfloat block[HISTORY_FRAMES];
+
+  for (guint c = 0; c < channels; ++c) {
+    BtEdbAdaaState adaa = self->adaa_state[c];
+    OversampledContext context = { self, gains_per_sample(&self->snapshot->gains, factor), &adaa };
+
+    memcpy(
+      block, self->history + (gsize)(c + 1) * HISTORY_FRAMES - pending - nframes, nframes * sizeof(gfloat));
+    btedb_oversampler_process(self->oversampler, c, block, 1, nframes, distort_oversampled, &context);
+  }
+
+  btedb_denormals_restore(fp_mode);
+}
+
+// Adds a buffer of input to the history of each channel.
+static void history_add(BtEdbDistortInternal* const self, guint8* const* sources, guint stride, guint nframes) {
+  const guint channels = GST_AUDIO_INFO_CHANNELS(&self->info);
+  const guint size = btedb_sample_format_size(self->format);
+  const guint n = MIN(nframes, HISTORY_FRAMES);
+
+  for (guint c = 0; c < channels; ++c) {
+    gfloat* const history = self->history + (gsize)c * HISTORY_FRAMES;
+    memmove(history, history + n, (HISTORY_FRAMES - n) * sizeof(gfloat));
+    btedb_samples_to_float(
+      self->format, sources[c] + (gsize)(nframes - n) * stride * size, stride, history + HISTORY_FRAMES - n, n);
+  }
+}
+
+// Finds the address of each channel's first sample in a mapped buffer, and returns the stride.
+static guint channel_pointers(const BtEdbDistortInternal* const self, GstAudioBuffer* abuf, guint8** channel_data) {
+  const guint channels = GST_AUDIO_INFO_CHANNELS(&self->info);
+
+  // Interleaved audio has one plane holding every channel.
+  if (GST_AUDIO_INFO_LAYOUT(&self->info) == GST_AUDIO_LAYOUT_INTERLEAVED) {
+    for (guint c = 0; c < channels; ++c) {
+      channel_data[c] = (guint8*)GST_AUDIO_BUFFER_PLANE_DATA(abuf, 0) + c * GST_AUDIO_INFO_BPS(&self->info);
+    }
+    return channels;
+  } else {
+    for (guint c = 0; c < channels; ++c) {
+      channel_data[c] = (guint8*)GST_AUDIO_BUFFER_PLANE_DATA(abuf, c);
+    }
+    return 1;
+  }
+}
+
+/*
+  Distorts "inbuf" into "outbuf", which may be the same buffer. When they differ, the input is only read, so read-only
+  buffers don't have to be copied before they're distorted.
+ */
+static GstFlowReturn transform_buffer(BtEdbDistortInternal* const self, GstBuffer* inbuf, GstBuffer* outbuf) {
   struct timespec clock_start;
   clock_gettime(CLOCK_MONOTONIC_RAW, &clock_start);
 
-  BtEdbDistortInternal* const self = (BtEdbDistortInternal*)baset;
-  
-  GstMapInfo info;
-  
-  if (!gst_buffer_map(gstbuf, &info, GST_MAP_READ | GST_MAP_WRITE)) {
-    GST_ERROR_OBJECT(self, "unable to map buffer for read & write");
-    return GST_FLOW_ERROR;
+  const gboolean in_place = inbuf == outbuf;
+  GstAudioBuffer in_abuf;
+  GstAudioBuffer out_abuf;
+
+  if (in_place) {
+    if (!gst_audio_buffer_map(&out_abuf, &self->info, outbuf, GST_MAP_READWRITE)) {
+      GST_ERROR_OBJECT(self, "unable to map buffer for read & write");
+      return GST_FLOW_ERROR;
+    }
+    in_abuf = out_abuf;
+  } else {
+    if (!gst_audio_buffer_map(&in_abuf, &self->info, inbuf, GST_MAP_READ)) {
+      GST_ERROR_OBJECT(self, "unable to map input buffer for read");
+      return GST_FLOW_ERROR;
+    }
+    if (!gst_audio_buffer_map(&out_abuf, &self->info, outbuf, GST_MAP_WRITE)) {
+      GST_ERROR_OBJECT(self, "unable to map output buffer for write");
+      gst_audio_buffer_unmap(&in_abuf);
+      return GST_FLOW_ERROR;
+    }
+  }
+
+  const guint channels = GST_AUDIO_INFO_CHANNELS(&self->info);
+  const guint nframes = GST_AUDIO_BUFFER_N_SAMPLES(&in_abuf);
+  const guint nsamples = nframes * channels;
+
+  guint8** const sources = g_newa(guint8*, channels);
+  guint8** const channel_data = g_newa(guint8*, channels);
+  const guint stride = channel_pointers(self, &in_abuf, sources);
+  channel_pointers(self, &out_abuf, channel_data);
+
+  if (self->active_oversampler_type == BTEDB_DISTORT_OVERSAMPLER_INTERNAL) {
+    const guint factor = effective_oversample(self);
+
+    const BtEdbOversamplerQuality quality = oversampler_quality(self);
+    const gboolean pipelined = self->pipelined;
+
+    // Unlike the audioresample elements, the internal oversampler can follow changes to its settings immediately.
+    if (!self->oversampler ||
+        btedb_oversampler_get_factor(self->oversampler) != factor ||
+        btedb_oversampler_get_quality(self->oversampler) != quality ||
+        pipelined != (self->pipeline != NULL)) {
+      /*
+        A pipeline carries on with the new oversampler, once it's finished with the old one. Input that it hasn't
+        started on yet is left for the new one. Turning the pipeline on or off changes the latency, which can't be
+        done without a glitch, so its contents are simply dropped.
+      */
+      guint pending = 0;
+      if (self->pipeline && pipelined) {
+        btedb_pipeline_wait_idle(self->pipeline);
+        pending = btedb_pipeline_get_pending(self->pipeline);
+      } else {
+        g_clear_pointer(&self->pipeline, btedb_pipeline_free);
+      }
+
+      BtEdbOversampler* const old_oversampler = self->oversampler;
+      self->oversampler = btedb_oversampler_new(factor, channels, quality);
+      /*
+        After priming, the filters hold what they would have if this oversampler had always been used, so the count of
+        silent frames still applies.
+      */
+      oversampler_prime(self, pending);
+
+      if (self->pipeline) {
+        btedb_pipeline_set_oversampler(self->pipeline, self->oversampler);
+      } else if (pipelined) {
+        self->pipeline = btedb_pipeline_new(
+          self->oversampler, self->format, sizeof(PipelineBlock), pipeline_block_clear, pipeline_distort, self);
+      }
+
+      if (old_oversampler)
+        btedb_oversampler_free(old_oversampler);
+      update_latency(self);
+    }
+
+    history_add(self, sources, stride, nframes);
+  }
+
+  // Silence distorts to silence. Once the internal oversampler's filters are clear too, there's nothing to do.
+  const gboolean silent =
+    GST_BUFFER_FLAG_IS_SET(inbuf, GST_BUFFER_FLAG_GAP) || is_silent(&in_abuf, GST_AUDIO_INFO_BPS(&self->info));
+  guint64 tail = self->active_oversampler_type == BTEDB_DISTORT_OVERSAMPLER_INTERNAL ?
+    btedb_oversampler_get_tail(self->oversampler) : 0;
+  // The ADAA modes remember the last few inputs, which must be silent too.
+  const BtEdbDistortMode mode = effective_mode(self);
+  if (mode_is_adaa(mode))
+    tail += adaa_order(mode);
+  // The pipeline's output is behind its input, so its last few frames of input haven't been heard yet.
+  if (self->pipeline)
+    tail += BTEDB_PIPELINE_DELAY_FRAMES;
+
+  if (silent && self->silent_frames >= tail) {
+    if (!in_place) {
+      for (guint p = 0; p < GST_AUDIO_BUFFER_N_PLANES(&out_abuf); ++p) {
+        memset(GST_AUDIO_BUFFER_PLANE_DATA(&out_abuf, p), 0, GST_AUDIO_BUFFER_PLANE_SIZE(&out_abuf));
+      }
+    }
+    GST_BUFFER_FLAG_SET(outbuf, GST_BUFFER_FLAG_GAP);
+  } else {
+    // Even if the input was silent, the oversampler's output isn't yet.
+    GST_BUFFER_FLAG_UNSET(outbuf, GST_BUFFER_FLAG_GAP);
+    process(self, GST_BUFFER_PTS(inbuf), sources, channel_data, stride, nframes);
   }
 
-  gfloat* data = (gfloat*)info.data;
-  guint nsamples = info.size / sizeof(typeof(*data));
-  distort(self, data, nsamples);
-   
-  gst_buffer_unmap (gstbuf, &info);
+  self->silent_frames = silent ? self->silent_frames + nframes : 0;
+
+  if (!in_place)
+    gst_audio_buffer_unmap(&in_abuf);
+  gst_audio_buffer_unmap(&out_abuf);
 
   struct timespec clock_end;
   clock_gettime(CLOCK_MONOTONIC_RAW, &clock_end);
-  self->perf_time += (clock_end.tv_sec - clock_start.tv_sec) * 1e9L + (clock_end.tv_nsec - clock_start.tv_nsec);
-  self->perf_samples += nsamples;
-  if (self->perf_time >= 1e8f) {
-    GST_DEBUG("Avg perf: %f samples/sec\n", self->perf_samples / (self->perf_time / 1e9f));
-    self->perf_time = 0;
-    self->perf_samples = 0;
+  const guint64 time =
+    (clock_end.tv_sec - clock_start.tv_sec) * GST_SECOND + clock_end.tv_nsec - clock_start.tv_nsec;
+  const guint64 duration = gst_util_uint64_scale_int(nframes, GST_SECOND, GST_AUDIO_INFO_RATE(&self->info));
+
+  GST_LOG_OBJECT(self, "processed %u frames %s in %" G_GUINT64_FORMAT "ns, load %f", nframes,
+                 in_place ? "in place" : "into a new buffer", time, duration ? (gdouble)time / duration : 0);
+
+  GST_OBJECT_LOCK(self);
+  self->processing_rate = GST_AUDIO_INFO_RATE(&self->info) *
+    (self->oversampler ? btedb_oversampler_get_factor(self->oversampler) : 1);
+  btedb_stats_add(&self->stats, time, duration, nsamples);
+  GST_OBJECT_UNLOCK(self);
+
+  qos_update(self, GST_BUFFER_PTS(inbuf), time, duration);
+
+  return GST_FLOW_OK;
+}
+
+static GstFlowReturn transform_ip(GstBaseTransform* baset, GstBuffer* gstbuf) {
+  return transform_buffer((BtEdbDistortInternal*)baset, gstbuf, gstbuf);
+}
+
+static GstFlowReturn transform(GstBaseTransform* baset, GstBuffer* inbuf, GstBuffer* outbuf) {
+  return transform_buffer((BtEdbDistortInternal*)baset, inbuf, outbuf);
+}
+
+static void output_pool_clear(BtEdbDistortInternal* const self) {
+  if (self->pool) {
+    gst_buffer_pool_set_active(self->pool, FALSE);
+    gst_clear_object(&self->pool);
   }
-  
+}
+
+static GstBufferPool* output_pool_new(BtEdbDistortInternal* const self, gsize size) {
+  GstBufferPool* const pool = gst_buffer_pool_new();
+  GstStructure* const config = gst_buffer_pool_get_config(pool);
+  GstCaps* const caps = gst_audio_info_to_caps(&self->info);
+
+  GstAllocationParams params;
+  gst_allocation_params_init(&params);
+  params.align = BUFFER_ALIGN - 1;
+
+  gst_buffer_pool_config_set_params(config, caps, size, 0, 0);
+  gst_buffer_pool_config_set_allocator(config, NULL, &params);
+  gst_caps_unref(caps);
+
+  if (!gst_buffer_pool_set_config(pool, config) || !gst_buffer_pool_set_active(pool, TRUE)) {
+    gst_object_unref(pool);
+    return NULL;
+  }
+
+  self->pool_buffer_size = size;
+  return pool;
+}
+
+/*
+  Writable input is distorted in place. GstBaseTransform would copy read-only input before distorting it, so instead
+  it's given a buffer from the output pool, and distorted into that in one pass.
+ */
+static GstFlowReturn prepare_output_buffer(GstBaseTransform* trans, GstBuffer* input, GstBuffer** outbuf) {
+  BtEdbDistortInternal* const self = (BtEdbDistortInternal*)trans;
+
+  if (gst_base_transform_is_passthrough(trans) || gst_buffer_is_writable(input)) {
+    *outbuf = input;
+    return GST_FLOW_OK;
+  }
+
+  const gsize size = gst_buffer_get_size(input);
+
+  // The pool is made larger if a buffer doesn't fit. The old pool is freed once its buffers are returned to it.
+  if (!self->pool || size > self->pool_buffer_size) {
+    GST_DEBUG_OBJECT(self, "making output pool for %" G_GSIZE_FORMAT " byte buffers", size);
+    output_pool_clear(self);
+    self->pool = output_pool_new(self, MAX(size, self->pool_buffer_size));
+    if (!self->pool) {
+      GST_ERROR_OBJECT(self, "unable to make output pool");
+      return GST_FLOW_ERROR;
+    }
+  }
+
+  const GstFlowReturn result = gst_buffer_pool_acquire_buffer(self->pool, outbuf, NULL);
+  if (result != GST_FLOW_OK)
+    return result;
+
+  gst_buffer_resize(*outbuf, 0, size);
+  gst_buffer_copy_into(*outbuf, input, GST_BUFFER_COPY_METADATA, 0, -1);
+
+  GST_OBJECT_LOCK(self);
+  self->copies_avoided++;
+  GST_OBJECT_UNLOCK(self);
+
   return GST_FLOW_OK;
 }
 
+/*
+  Output buffers only come from this element's own pool, which is made ready here with buffers that will hold most
+  buffers at the negotiated rate, so that read-only input doesn't wait for an allocation. Downstream's pool isn't
+  used, as audio buffers vary in size.
+ */
+static gboolean decide_allocation(GstBaseTransform* trans, GstQuery* query) {
+  BtEdbDistortInternal* const self = (BtEdbDistortInternal*)trans;
+
+  output_pool_clear(self);
+  self->pool_buffer_size = 0;
+
+  const gsize size =
+    (gsize)GST_AUDIO_INFO_BPF(&self->info) * GST_AUDIO_INFO_RATE(&self->info) * POOL_BUFFER_TIME / 1000;
+  if (size > 0) {
+    self->pool = output_pool_new(self, size);
+    if (!self->pool)
+      GST_WARNING_OBJECT(self, "unable to make output pool, it will be made when first needed");
+  }
+
+  return GST_BASE_TRANSFORM_CLASS(btedb_distort_internal_parent_class)->decide_allocation(trans, query);
+}
+
+/*
+  Asks upstream for buffers aligned to cache lines, so that the kernels' vector loads don't straddle them. No pool is
+  offered: upstream elements size their buffers as they like, and a pool's buffers have a fixed size.
+ */
+static gboolean propose_allocation(GstBaseTransform* trans, GstQuery* decide_query, GstQuery* query) {
+  if (!GST_BASE_TRANSFORM_CLASS(btedb_distort_internal_parent_class)->propose_allocation(trans, decide_query, query))
+    return FALSE;
+
+  GstAllocationParams params;
+  gst_allocation_params_init(&params);
+  params.align = BUFFER_ALIGN - 1;
+  gst_query_add_allocation_param(query, NULL, &params);
+
+  return TRUE;
+}
 
 static void btedb_distort_internal_init(BtEdbDistortInternal* const self) {
+  const BtEdbDistortParams params = { 0 };
+  for (guint i = 0; i < G_N_ELEMENTS(self->params_slots); ++i) {
+    params_snapshot_init(&self->params_slots[i], &params);
+  }
+  btedb_triple_buffer_init(&self->params_buffer, &self->params_slots[0], &self->params_slots[1], &self->params_slots[2]);
+  self->snapshot = btedb_triple_buffer_read(&self->params_buffer, NULL);
+  g_mutex_init(&self->publish_lock);
+
+  // Buffers are marked as gaps here, when the output is known to be silent.
+  gst_base_transform_set_gap_aware((GstBaseTransform*)self, TRUE);
+  self->qos_recover_hold = QOS_RECOVER_HOLD;
+
+  // Buffers are distorted in place when they're writable. prepare_output_buffer decides.
+  gst_base_transform_set_in_place((GstBaseTransform*)self, FALSE);
+}
+
+static void internal_finalize(GObject* object) {
+  BtEdbDistortInternal* self = (BtEdbDistortInternal*)object;
+
+  // The pipeline's blocks hold references to tables too.
+  g_clear_pointer(&self->pipeline, btedb_pipeline_free);
+  for (guint i = 0; i < G_N_ELEMENTS(self->params_slots); ++i) {
+    params_snapshot_clear(&self->params_slots[i]);
+  }
+  g_mutex_clear(&self->publish_lock);
+
+  if (self->table) {
+    btedb_curve_table_unref(self->table);
+    self->table = NULL;
+  }
+
+  if (self->adaa_table) {
+    btedb_adaa_table_unref(self->adaa_table);
+    self->adaa_table = NULL;
+  }
+
+  if (self->polynomial) {
+    btedb_polynomial_unref(self->polynomial);
+    self->polynomial = NULL;
+  }
+
+  g_clear_pointer(&self->oversampler, btedb_oversampler_free);
+  g_clear_pointer(&self->workers, btedb_workers_free);
+  g_clear_pointer(&self->adaa_state, g_free);
+  g_clear_pointer(&self->history, g_free);
+  output_pool_clear(self);
+
+  G_OBJECT_CLASS(btedb_distort_internal_parent_class)->finalize(object);
 }
 
 static gboolean set_caps(
@@ -229,12 +1856,100 @@ static gboolean set_caps(
   GstCaps* incaps,
   GstCaps* outcaps) {
 
-  GST_DEBUG_OBJECT(trans, "incaps %s", gst_caps_to_string(incaps));
-  GST_DEBUG_OBJECT(trans, "outcaps %s", gst_caps_to_string(outcaps));
+  BtEdbDistortInternal* const self = (BtEdbDistortInternal*)trans;
+
+  GST_DEBUG_OBJECT(trans, "incaps %" GST_PTR_FORMAT, incaps);
+  GST_DEBUG_OBJECT(trans, "outcaps %" GST_PTR_FORMAT, outcaps);
+
+  if (!gst_audio_info_from_caps(&self->info, incaps))
+    return FALSE;
+
+  switch (GST_AUDIO_INFO_FORMAT(&self->info)) {
+  case GST_AUDIO_FORMAT_F32: self->format = BTEDB_SAMPLE_F32; break;
+  case GST_AUDIO_FORMAT_F64: self->format = BTEDB_SAMPLE_F64; break;
+  case GST_AUDIO_FORMAT_S16: self->format = BTEDB_SAMPLE_S16; break;
+  case GST_AUDIO_FORMAT_S32: self->format = BTEDB_SAMPLE_S32; break;
+  default:
+    GST_ERROR_OBJECT(self, "unsupported format %s", gst_audio_format_to_string(GST_AUDIO_INFO_FORMAT(&self->info)));
+    return FALSE;
+  }
+
+  // The caps have been negotiated to suit this type, so it must stay in effect until the next negotiation.
+  self->active_oversampler_type = requested_oversampler_type(self);
+
+  // Filter state from the previous stream isn't relevant, and the channel count may have changed.
+  g_clear_pointer(&self->pipeline, btedb_pipeline_free);
+  g_clear_pointer(&self->oversampler, btedb_oversampler_free);
+  g_free(self->adaa_state);
+  self->adaa_state = g_new0(BtEdbAdaaState, GST_AUDIO_INFO_CHANNELS(&self->info));
+  g_free(self->history);
+  self->history = g_new0(gfloat, (gsize)GST_AUDIO_INFO_CHANNELS(&self->info) * HISTORY_FRAMES);
+  // Nothing has been heard yet, so there's nothing for the filters to hold.
+  self->silent_frames = G_MAXUINT32;
+
+  self->active_resample_oversample =
+    self->active_oversampler_type == BTEDB_DISTORT_OVERSAMPLER_INTERNAL ? 1 : resample_oversample(self);
+
+  GST_OBJECT_LOCK(self);
+  self->rate = GST_AUDIO_INFO_RATE(&self->info);
+  self->base_rate = self->rate / self->active_resample_oversample;
+  self->control_interval = self->base_rate > 0 ? MAX(1, CONTROL_INTERVAL_FRAMES * self->rate / self->base_rate) : 1;
+  GST_OBJECT_UNLOCK(self);
+
+  update_latency(self);
 
   return TRUE;
 }
 
+typedef struct {
+  GstStructure* in;
+  guint oversample;
+  GstCaps* out;
+} OversampledCaps;
+
+/*
+  Caps offered upstream so far, shared by every instance. Caps queries are repeated many times while a song starts,
+  for every instance, and almost always with the same few structures.
+*/
+G_LOCK_DEFINE_STATIC(oversampled_caps_cache);
+static GQueue oversampled_caps_cache = G_QUEUE_INIT;
+
+// Enough for a few formats at each common rate. The least recently added entry is dropped beyond this.
+#define OVERSAMPLED_CAPS_CACHE_SIZE 32
+
+// Returns a reference to caps like "structure", but with "rate" multiplied by "oversample".
+static GstCaps* oversampled_caps(const GstStructure* structure, gint rate, guint oversample) {
+  G_LOCK(oversampled_caps_cache);
+  for (GList* i = oversampled_caps_cache.head; i; i = i->next) {
+    const OversampledCaps* const entry = (const OversampledCaps*)i->data;
+    if (entry->oversample == oversample && gst_structure_is_equal(entry->in, structure)) {
+      GstCaps* const result = gst_caps_ref(entry->out);
+      G_UNLOCK(oversampled_caps_cache);
+      return result;
+    }
+  }
+  G_UNLOCK(oversampled_caps_cache);
+
+  OversampledCaps* const entry = g_new(OversampledCaps, 1);
+  entry->in = gst_structure_copy(structure);
+  entry->oversample = oversample;
+  entry->out = gst_caps_new_full(gst_structure_copy(structure), NULL);
+  gst_structure_set(gst_caps_get_structure(entry->out, 0), "rate", G_TYPE_INT, rate * oversample, NULL);
+  GstCaps* const result = gst_caps_ref(entry->out);
+
+  G_LOCK(oversampled_caps_cache);
+  g_queue_push_head(&oversampled_caps_cache, entry);
+  if (g_queue_get_length(&oversampled_caps_cache) > OVERSAMPLED_CAPS_CACHE_SIZE) {
+    OversampledCaps* const oldest = (OversampledCaps*)g_queue_pop_tail(&oversampled_caps_cache);
+    gst_structure_free(oldest->in);
+    gst_caps_unref(oldest->out);
+    g_free(oldest);
+  }
+  G_UNLOCK(oversampled_caps_cache);
+
+  return result;
+}
+
 /*
   This callback is attached to the "sink" pad of the internal Distort effect.
   It's called at the start of playback, when GStreamer is figuring out how to fixate caps for all the machines.
@@ -254,38 +1969,30 @@ static gboolean query_distort_sink(GstPad* pad, GstObject* parent, GstQuery* que
     GstCaps* caps_in;
     
     gst_query_parse_caps(query, &caps_in);
-    GST_DEBUG_OBJECT(parent, "query caps_in %s", gst_caps_to_string(caps_in));
-
-    GstCaps* caps_sink = gst_pad_get_current_caps(pad);
-    GST_DEBUG_OBJECT(parent, "query caps_sink %s", gst_caps_to_string(caps_sink));
+    GST_DEBUG_OBJECT(parent, "query caps_in %" GST_PTR_FORMAT, caps_in);
 
-    GstPad* pad_src = gst_element_get_static_pad((GstElement*)parent, "src");
-    GstCaps* caps_src = gst_pad_get_current_caps(pad_src);
-    GST_DEBUG_OBJECT(parent, "query caps_src %s", gst_caps_to_string(caps_src));
-    
     // If there are no caps in the query, then there is no information on which to act.
     // If the incoming caps are already fixed, then the final oversampled rate has already been presented upstream
     // and there is nothing to do.
-    if (caps_in && !gst_caps_is_fixed(caps_in)) {
+    if (requested_oversampler_type(self) == BTEDB_DISTORT_OVERSAMPLER_AUDIORESAMPLE && caps_in && !gst_caps_is_fixed(caps_in)) {
+      const guint oversample = resample_oversample(self);
+      g_assert(oversample != 0);
+
       // At this point the incoming caps will present one or more structures that may or may not be fixed.
       // Find the first structure having a fixed "rate" value. This is the sample rate coming from upstream.
       // If found, then present the fixed caps with oversampled rate to the upstream audioresample element.
       // If there is no fixed rate value, then negotiation still hasn't progressed far enough to be able to fix
       // "distort"'s caps.
-      for (gint i = 0; i < gst_caps_get_size(caps_in); i++) {
-        GstStructure* structure = gst_caps_get_structure(caps_in, i);
+      for (guint i = 0; i < gst_caps_get_size(caps_in); i++) {
+        const GstStructure* const structure = gst_caps_get_structure(caps_in, i);
 
         int rate;
         if (gst_structure_get_int(structure, "rate", &rate)) {
-          GST_DEBUG_OBJECT(parent, "query fixed caps_in rate is %d in structure idx %d", rate, i);
-          GST_DEBUG_OBJECT(parent, "query oversample factor is %d", self->oversample);
-
-          g_assert(self->oversample != 0);
-          
-          GstCaps* caps_out = gst_caps_copy_nth(caps_in, i);
-          GST_DEBUG_OBJECT(parent, "query caps_out before %s", gst_caps_to_string(caps_out));
-          gst_structure_set(gst_caps_get_structure(caps_out, 0), "rate", G_TYPE_INT, rate * self->oversample, NULL);
-          GST_DEBUG_OBJECT(parent, "query caps_out %s", gst_caps_to_string(caps_out));
+          GST_DEBUG_OBJECT(parent, "query fixed caps_in rate is %d in structure idx %u, oversample factor is %u", rate,
+                           i, oversample);
+
+          GstCaps* const caps_out = oversampled_caps(structure, rate, oversample);
+          GST_DEBUG_OBJECT(parent, "query caps_out %" GST_PTR_FORMAT, caps_out);
           gst_query_set_caps_result(query, caps_out);
           gst_caps_unref(caps_out);
           result = TRUE;
@@ -295,9 +2002,6 @@ static gboolean query_distort_sink(GstPad* pad, GstObject* parent, GstQuery* que
       result = gst_pad_query_default(pad, parent, query);
     }
 
-    if (caps_sink) gst_caps_unref(caps_sink);
-    if (caps_src) gst_caps_unref(caps_src);
-    gst_clear_object(&pad_src);
     return result;
   }
   default:
@@ -305,13 +2009,60 @@ static gboolean query_distort_sink(GstPad* pad, GstObject* parent, GstQuery* que
   }
 }
 
+/*
+  Adds the latency of the internal oversampler to the latency reported upstream. The audioresample elements add their
+  own.
+ */
+static gboolean internal_query(GstBaseTransform* trans, GstPadDirection direction, GstQuery* query) {
+  BtEdbDistortInternal* const self = (BtEdbDistortInternal*)trans;
+  GstBaseTransformClass* const parent_class = GST_BASE_TRANSFORM_CLASS(btedb_distort_internal_parent_class);
+
+  if (direction != GST_PAD_SRC || GST_QUERY_TYPE(query) != GST_QUERY_LATENCY)
+    return parent_class->query(trans, direction, query);
+
+  if (!parent_class->query(trans, direction, query))
+    return FALSE;
+
+  gboolean live;
+  GstClockTime min, max;
+  gst_query_parse_latency(query, &live, &min, &max);
+
+  GST_OBJECT_LOCK(self);
+  const GstClockTime latency = self->latency;
+  GST_OBJECT_UNLOCK(self);
+
+  GST_DEBUG_OBJECT(self, "adding latency %" GST_TIME_FORMAT, GST_TIME_ARGS(latency));
+
+  min += latency;
+  if (GST_CLOCK_TIME_IS_VALID(max))
+    max += latency;
+
+  gst_query_set_latency(query, live, min, max);
+  return TRUE;
+}
+
 static void dispose(GObject* object) {
   BtEdbDistort* self = (BtEdbDistort*)object;
   btedb_properties_simple_free(self->props);
   self->props = 0;
 }
 
+static void finalize(GObject* object) {
+  BtEdbDistort* self = (BtEdbDistort*)object;
+  g_mutex_clear(&self->params_lock);
+
+  G_OBJECT_CLASS(btedb_distort_parent_class)->finalize(object);
+}
+
 static void btedb_distort_internal_class_init(BtEdbDistortInternalClass* const klass) {
+  {
+    GObjectClass* const aclass = (GObjectClass*)klass;
+    aclass->finalize = internal_finalize;
+  }
+
+  // One thread is enough, as tables are quick to build and only the most recent request is acted upon.
+  table_pool = g_thread_pool_new(table_pool_func, NULL, 1, FALSE, NULL);
+
   {
     GstElementClass* const aclass = (GstElementClass*)klass;
 
@@ -322,7 +2073,13 @@ static void btedb_distort_internal_class_init(BtEdbDistortInternalClass* const k
   {
     GstBaseTransformClass* aclass = (GstBaseTransformClass*)klass;
     aclass->transform_ip = transform_ip;
+    aclass->transform = transform;
+    aclass->prepare_output_buffer = prepare_output_buffer;
+    aclass->decide_allocation = decide_allocation;
+    aclass->propose_allocation = propose_allocation;
+    aclass->src_event = src_event;
     aclass->set_caps = set_caps;
+    aclass->query = internal_query;
   }
 }
 
@@ -332,6 +2089,7 @@ static void btedb_distort_class_init(BtEdbDistortClass* const klass) {
     aclass->set_property = set_property;
     aclass->get_property = get_property;
     aclass->dispose = dispose;
+    aclass->finalize = finalize;
 
     // Note: variables will not be set to default values unless G_PARAM_CONSTRUCT is given.
     const GParamFlags flags =
@@ -381,6 +2139,68 @@ static void btedb_distort_class_init(BtEdbDistortClass* const klass) {
     g_object_class_install_property(
       aclass, idx++,
       g_param_spec_float("db-postgain", "Postgain dB", "Postgain dB", -144, 144, 0, flags));
+
+    g_object_class_install_property(
+      aclass, idx++,
+      g_param_spec_enum("mode", "Mode", "Curve evaluation mode", btedb_distort_mode_get_type(),
+                        BTEDB_DISTORT_MODE_EXACT, flags ^ GST_PARAM_CONTROLLABLE));
+
+    g_object_class_install_property(
+      aclass, idx++,
+      g_param_spec_uint("table-size", "Table Size", "Number of curve table entries", 16, 65536, 4096,
+                        flags ^ GST_PARAM_CONTROLLABLE));
+
+    g_object_class_install_property(
+      aclass, idx++,
+      g_param_spec_enum("table-interp", "Table Interpolation", "Curve table interpolation", btedb_interp_get_type(),
+                        BTEDB_INTERP_LINEAR, flags ^ GST_PARAM_CONTROLLABLE));
+
+    g_object_class_install_property(
+      aclass, idx++,
+      g_param_spec_enum("oversampler", "Oversampler", "Oversampling method", btedb_distort_oversampler_get_type(),
+                        BTEDB_DISTORT_OVERSAMPLER_INTERNAL, flags ^ GST_PARAM_CONTROLLABLE));
+
+    g_object_class_install_property(
+      aclass, idx++,
+      g_param_spec_boolean("low-latency", "Low Latency", "Use short oversampling filters, for less latency",
+                           FALSE, flags ^ GST_PARAM_CONTROLLABLE));
+
+    pspec_latency = g_param_spec_uint64(
+      "latency", "Latency", "Latency added by oversampling, in nanoseconds", 0, G_MAXUINT64, 0,
+      G_PARAM_READABLE | G_PARAM_STATIC_STRINGS);
+    g_object_class_install_property(aclass, idx++, pspec_latency);
+
+    g_object_class_install_property(
+      aclass, idx++,
+      g_param_spec_uint("threads", "Threads", "Number of processing threads, or 0 for one per CPU", 0, 64, 1,
+                        flags ^ GST_PARAM_CONTROLLABLE));
+
+    pspec_stats = g_param_spec_boxed(
+      "stats", "Statistics", "Processing time and load statistics", GST_TYPE_STRUCTURE,
+      G_PARAM_READABLE | G_PARAM_STATIC_STRINGS);
+    g_object_class_install_property(aclass, idx++, pspec_stats);
+
+    g_object_class_install_property(
+      aclass, idx++,
+      g_param_spec_boolean("qos", "QoS", "Lower quality when playback falls behind, rather than breaking up", FALSE,
+                           flags ^ GST_PARAM_CONTROLLABLE));
+
+    pspec_qos_level = g_param_spec_uint(
+      "qos-level", "QoS Level", "How far quality has been lowered to keep up with playback, or 0 for full quality",
+      0, G_MAXUINT, 0, G_PARAM_READABLE | G_PARAM_STATIC_STRINGS);
+    g_object_class_install_property(aclass, idx++, pspec_qos_level);
+
+    g_object_class_install_property(
+      aclass, idx++,
+      g_param_spec_boolean("pipelined", "Pipelined",
+                           "Upsample, distort and downsample on separate threads, with the internal oversampler",
+                           FALSE, flags ^ GST_PARAM_CONTROLLABLE));
+
+    g_object_class_install_property(
+      aclass, idx++,
+      g_param_spec_enum("profile", "Profile", "Trade quality for speed or memory throughout the effect",
+                        btedb_distort_profile_get_type(), BTEDB_DISTORT_PROFILE_REALTIME,
+                        flags ^ GST_PARAM_CONTROLLABLE));
   }
 
   {
@@ -424,25 +2244,42 @@ static void btedb_distort_class_init(BtEdbDistortClass* const klass) {
 
 static void btedb_distort_init(BtEdbDistort* const self) {
   self->distort = (BtEdbDistortInternal*)g_object_new(btedb_distort_internal_get_type(), NULL);
+  g_mutex_init(&self->params_lock);
   
   self->props = btedb_properties_simple_new((GObject*)self);
   btedb_properties_simple_add(self->props, "oversample", &self->distort->oversample);
-  btedb_properties_simple_add(self->props, "pos-db-pregain", &self->distort->pos_db_pregain);
-  btedb_properties_simple_add(self->props, "pos-shape-a", &self->distort->pos_shape_a);
-  btedb_properties_simple_add(self->props, "pos-shape-b", &self->distort->pos_shape_b);
-  btedb_properties_simple_add(self->props, "pos-shape-exp", &self->distort->pos_shape_exp);
-  btedb_properties_simple_add(self->props, "symmetric", &self->distort->symmetric);
-  btedb_properties_simple_add(self->props, "neg-db-pregain", &self->distort->neg_db_pregain);
-  btedb_properties_simple_add(self->props, "neg-shape-a", &self->distort->neg_shape_a);
-  btedb_properties_simple_add(self->props, "neg-shape-b", &self->distort->neg_shape_b);
-  btedb_properties_simple_add(self->props, "neg-shape-exp", &self->distort->neg_shape_exp);
-  btedb_properties_simple_add(self->props, "db-postgain", &self->distort->db_postgain);
-
-  // GST_AUDIO_RESAMPLER_FILTER_MODE_FULL is fastest, but uses the most memory.
+  btedb_properties_simple_add(self->props, "oversampler", &self->distort->oversampler_type);
+  btedb_properties_simple_add(self->props, "low-latency", &self->distort->low_latency);
+  btedb_properties_simple_add(self->props, "pos-db-pregain", &self->params.pos_db_pregain);
+  btedb_properties_simple_add(self->props, "pos-shape-a", &self->params.pos_shape_a);
+  btedb_properties_simple_add(self->props, "pos-shape-b", &self->params.pos_shape_b);
+  btedb_properties_simple_add(self->props, "pos-shape-exp", &self->params.pos_shape_exp);
+  btedb_properties_simple_add(self->props, "symmetric", &self->params.symmetric);
+  btedb_properties_simple_add(self->props, "neg-db-pregain", &self->params.neg_db_pregain);
+  btedb_properties_simple_add(self->props, "neg-shape-a", &self->params.neg_shape_a);
+  btedb_properties_simple_add(self->props, "neg-shape-b", &self->params.neg_shape_b);
+  btedb_properties_simple_add(self->props, "neg-shape-exp", &self->params.neg_shape_exp);
+  btedb_properties_simple_add(self->props, "db-postgain", &self->params.db_postgain);
+  btedb_properties_simple_add(self->props, "mode", &self->distort->mode);
+  btedb_properties_simple_add(self->props, "table-size", &self->distort->table_size);
+  btedb_properties_simple_add(self->props, "table-interp", &self->distort->table_interp);
+  btedb_properties_simple_add(self->props, "threads", &self->distort->threads);
+  btedb_properties_simple_add(self->props, "pipelined", &self->distort->pipelined);
+  btedb_properties_simple_add(self->props, "qos", &self->distort->qos);
+  btedb_properties_simple_add(self->props, "profile", &self->distort->profile);
+
+  /*
+    GST_AUDIO_RESAMPLER_FILTER_MODE_FULL is fastest, but uses the most memory. The tables are private to each element,
+    so they can't be shared between instances, and every instance that uses audioresample builds its own pair. That's
+    most of the per-instance memory with this oversampler. The internal oversampler, which is the default, shares its
+    coefficients instead. The low memory profile uses interpolated tables.
+  */
+  self->resample_quality = GST_AUDIO_RESAMPLER_QUALITY_DEFAULT;
+  self->resample_filter_mode = GST_AUDIO_RESAMPLER_FILTER_MODE_FULL;
   self->resample_in = gst_element_factory_make("audioresample", NULL);
-  g_object_set(self->resample_in, "sinc-filter-mode", GST_AUDIO_RESAMPLER_FILTER_MODE_FULL, NULL);
+  g_object_set(self->resample_in, "sinc-filter-mode", self->resample_filter_mode, NULL);
   self->resample_out = gst_element_factory_make("audioresample", NULL);
-  g_object_set(self->resample_out, "sinc-filter-mode", GST_AUDIO_RESAMPLER_FILTER_MODE_FULL, NULL);
+  g_object_set(self->resample_out, "sinc-filter-mode", self->resample_filter_mode, NULL);
 
   self->distort->resample_in = self->resample_in;
   self->distort->resample_out = self->resample_out;
@@ -473,4 +2310,5 @@ static void btedb_distort_init(BtEdbDistort* const self) {
   }
 
   self->gfx = (struct GstBtUiCustomGfxResponse){0, GFX_WIDTH, GFX_HEIGHT, self->gfx_data};
+  self->gfx_dirty = TRUE;
 }
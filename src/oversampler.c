@@ -0,0 +1,451 @@
+/*
+  Distort effect for Buzztrax
+  Copyright (C) 2020 David Beswick
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "config.h"
+#include "src/oversampler.h"
+
+#include <math.h>
+#include <string.h>
+
+#define MAX_STAGES 6
+#define MAX_FACTOR (1 << MAX_STAGES)
+
+// Input frames per block. The largest buffer used is BLOCK_FRAMES * factor samples.
+#define BLOCK_FRAMES 64
+
+/*
+  The first stage (i.e. the one that runs at the lowest rate) must have a sharp transition band to preserve the
+  audible range. The images left for later stages are far from the passband, so much shorter filters will do.
+
+  "beta" is the Kaiser window parameter, which trades transition width for stopband attenuation.
+*/
+typedef struct {
+  guint first_stage_taps;
+  guint stage_taps;
+  gdouble beta;
+} QualityDesign;
+
+static const QualityDesign quality_designs[] = {
+  [BTEDB_OVERSAMPLER_QUALITY_HIGH] = { 32, 8, 10.0 },
+  [BTEDB_OVERSAMPLER_QUALITY_LOW_LATENCY] = { 8, 4, 7.0 }
+};
+
+/*
+  A half-band filter has a centre tap of 0.5, and every other even tap is zero. Only the odd taps on one side are
+  stored: coeffs[k] is the value of taps -(2k+1) and +(2k+1).
+*/
+typedef struct {
+  guint taps;
+  const gfloat* coeffs;
+} Stage;
+
+/*
+  The coefficients for one factor and quality, which are the same for every oversampler and at every sample rate.
+  They're shared by all the oversamplers in the process, and freed along with the last one using them.
+*/
+typedef struct {
+  guint factor;
+  BtEdbOversamplerQuality quality;
+  guint refcount;
+  guint nstages;
+  Stage stages[MAX_STAGES];
+  gsize bytes;
+} Coeffs;
+
+G_LOCK_DEFINE_STATIC(coeffs_cache);
+static GSList* coeffs_cache;
+static gsize coeffs_cache_bytes;
+
+typedef struct {
+  // Filter histories, each followed by room for a block of new samples.
+  gfloat* up[MAX_STAGES];
+  gfloat* down_even[MAX_STAGES];
+  gfloat* down_odd[MAX_STAGES];
+  gfloat* work[2];
+  gfloat* storage;
+  gsize storage_len;
+} Channel;
+
+struct _BtEdbOversampler {
+  guint factor;
+  BtEdbOversamplerQuality quality;
+  guint nstages;
+  guint channels;
+  Coeffs* coeffs;
+  const Stage* stages;
+  Channel* channel_state;
+};
+
+static gdouble bessel_i0(gdouble x) {
+  gdouble sum = 1;
+  gdouble term = 1;
+  for (guint k = 1; k < 50; ++k) {
+    term *= (x / (2 * k)) * (x / (2 * k));
+    sum += term;
+    if (term < sum * 1e-12)
+      break;
+  }
+  return sum;
+}
+
+static gfloat* stage_design(guint taps, gdouble beta) {
+  const gdouble half_len = 2 * taps;
+  gdouble sum = 0;
+
+  gfloat* const result = g_new(gfloat, taps);
+
+  gdouble* const h = g_new(gdouble, taps);
+  for (guint k = 0; k < taps; ++k) {
+    const gdouble n = 2 * k + 1;
+    const gdouble sinc = ((k & 1) ? -1.0 : 1.0) / (G_PI * n);
+    const gdouble ratio = n / half_len;
+    const gdouble window = bessel_i0(beta * sqrt(1 - ratio * ratio)) / bessel_i0(beta);
+    h[k] = sinc * window;
+    sum += h[k];
+  }
+
+  // Normalize for unity gain at DC: the centre tap contributes 0.5 and each pair of odd taps contributes 2 * h[k].
+  for (guint k = 0; k < taps; ++k) {
+    result[k] = h[k] * 0.25 / sum;
+  }
+
+  g_free(h);
+
+  return result;
+}
+
+/*
+  "s" points at the oldest of the last 2 * taps samples. Returns the sum of the odd taps, which are symmetric around
+  the point halfway between s[taps-1] and s[taps].
+ */
+static inline gfloat odd_taps(const Stage* const stage, const gfloat* const s) {
+  const guint taps = stage->taps;
+  gfloat acc = 0;
+  for (guint k = 0; k < taps; ++k) {
+    acc += stage->coeffs[k] * (s[taps + k] + s[taps - 1 - k]);
+  }
+  return acc;
+}
+
+// Produces 2 * n samples in "out" from n samples in "in".
+static void upsample(const Stage* const stage, gfloat* const hist, const gfloat* in, gfloat* out, guint n) {
+  const guint history = 2 * stage->taps - 1;
+  gfloat* const x = hist + history;
+
+  memcpy(x, in, n * sizeof(gfloat));
+
+  for (guint i = 0; i < n; ++i) {
+    const gfloat* const s = x + i - history;
+    out[2*i] = s[stage->taps - 1];
+    out[2*i + 1] = 2 * odd_taps(stage, s);
+  }
+
+  memmove(hist, hist + n, history * sizeof(gfloat));
+}
+
+// Produces n samples in "out" from 2 * n samples in "in".
+static void downsample(const Stage* const stage, gfloat* const even, gfloat* const odd, const gfloat* in, gfloat* out,
+                       guint n) {
+  const guint even_history = stage->taps - 1;
+  const guint odd_history = 2 * stage->taps - 1;
+  gfloat* const e = even + even_history;
+  gfloat* const o = odd + odd_history;
+
+  for (guint i = 0; i < n; ++i) {
+    e[i] = in[2*i];
+    o[i] = in[2*i + 1];
+  }
+
+  for (guint i = 0; i < n; ++i) {
+    out[i] = 0.5f * even[i] + odd_taps(stage, o + i - odd_history);
+  }
+
+  memmove(even, even + n, even_history * sizeof(gfloat));
+  memmove(odd, odd + n, odd_history * sizeof(gfloat));
+}
+
+guint btedb_oversampler_round_factor(guint factor) {
+  guint result = 1;
+  while (result < factor && result < MAX_FACTOR)
+    result <<= 1;
+  return result;
+}
+
+static void channel_init(Channel* ch, const BtEdbOversampler* self) {
+  gsize len = 2 * BLOCK_FRAMES * self->factor;
+  for (guint s = 0; s < self->nstages; ++s) {
+    const guint taps = self->stages[s].taps;
+    const guint block = BLOCK_FRAMES << s;
+    len += (2 * taps - 1 + block) + (taps - 1 + block) + (2 * taps - 1 + block);
+  }
+
+  ch->storage = g_new0(gfloat, len);
+  ch->storage_len = len;
+
+  gfloat* p = ch->storage;
+  ch->work[0] = p;
+  p += BLOCK_FRAMES * self->factor;
+  ch->work[1] = p;
+  p += BLOCK_FRAMES * self->factor;
+
+  for (guint s = 0; s < self->nstages; ++s) {
+    const guint taps = self->stages[s].taps;
+    const guint block = BLOCK_FRAMES << s;
+    ch->up[s] = p;
+    p += 2 * taps - 1 + block;
+    ch->down_even[s] = p;
+    p += taps - 1 + block;
+    ch->down_odd[s] = p;
+    p += 2 * taps - 1 + block;
+  }
+
+  g_assert(p == ch->storage + len);
+}
+
+static guint stage_taps(BtEdbOversamplerQuality quality, guint stage) {
+  return stage == 0 ? quality_designs[quality].first_stage_taps : quality_designs[quality].stage_taps;
+}
+
+static guint stage_count(guint factor) {
+  guint result = 0;
+  while ((1u << result) < factor)
+    result++;
+  return result;
+}
+
+static Coeffs* coeffs_ref(guint factor, BtEdbOversamplerQuality quality) {
+  G_LOCK(coeffs_cache);
+
+  for (GSList* i = coeffs_cache; i; i = i->next) {
+    Coeffs* const coeffs = (Coeffs*)i->data;
+    if (coeffs->factor == factor && coeffs->quality == quality) {
+      coeffs->refcount++;
+      G_UNLOCK(coeffs_cache);
+      return coeffs;
+    }
+  }
+
+  Coeffs* const coeffs = g_new0(Coeffs, 1);
+  coeffs->factor = factor;
+  coeffs->quality = quality;
+  coeffs->refcount = 1;
+  coeffs->nstages = stage_count(factor);
+  coeffs->bytes = sizeof(Coeffs);
+
+  for (guint s = 0; s < coeffs->nstages; ++s) {
+    const guint taps = stage_taps(quality, s);
+    coeffs->stages[s].taps = taps;
+    coeffs->stages[s].coeffs = stage_design(taps, quality_designs[quality].beta);
+    coeffs->bytes += taps * sizeof(gfloat);
+  }
+
+  coeffs_cache = g_slist_prepend(coeffs_cache, coeffs);
+  coeffs_cache_bytes += coeffs->bytes;
+
+  G_UNLOCK(coeffs_cache);
+  return coeffs;
+}
+
+static void coeffs_unref(Coeffs* coeffs) {
+  G_LOCK(coeffs_cache);
+
+  if (--coeffs->refcount > 0) {
+    G_UNLOCK(coeffs_cache);
+    return;
+  }
+
+  coeffs_cache = g_slist_remove(coeffs_cache, coeffs);
+  coeffs_cache_bytes -= coeffs->bytes;
+
+  G_UNLOCK(coeffs_cache);
+
+  for (guint s = 0; s < coeffs->nstages; ++s) {
+    g_free((gfloat*)coeffs->stages[s].coeffs);
+  }
+  g_free(coeffs);
+}
+
+gsize btedb_oversampler_get_shared_bytes(void) {
+  G_LOCK(coeffs_cache);
+  const gsize result = coeffs_cache_bytes;
+  G_UNLOCK(coeffs_cache);
+  return result;
+}
+
+BtEdbOversampler* btedb_oversampler_new(guint factor, guint channels, BtEdbOversamplerQuality quality) {
+  BtEdbOversampler* const self = g_new0(BtEdbOversampler, 1);
+
+  self->factor = btedb_oversampler_round_factor(factor);
+  self->quality = quality;
+  self->channels = channels;
+  self->coeffs = coeffs_ref(self->factor, quality);
+  self->nstages = self->coeffs->nstages;
+  self->stages = self->coeffs->stages;
+
+  self->channel_state = g_new0(Channel, channels);
+  for (guint c = 0; c < channels; ++c) {
+    channel_init(&self->channel_state[c], self);
+  }
+
+  return self;
+}
+
+void btedb_oversampler_free(BtEdbOversampler* self) {
+  for (guint c = 0; c < self->channels; ++c) {
+    g_free(self->channel_state[c].storage);
+  }
+  g_free(self->channel_state);
+
+  coeffs_unref(self->coeffs);
+
+  g_free(self);
+}
+
+guint btedb_oversampler_get_factor(const BtEdbOversampler* self) {
+  return self->factor;
+}
+
+guint btedb_oversampler_get_channels(const BtEdbOversampler* self) {
+  return self->channels;
+}
+
+BtEdbOversamplerQuality btedb_oversampler_get_quality(const BtEdbOversampler* self) {
+  return self->quality;
+}
+
+/*
+  At stage s, upsampling delays by "taps" samples and downsampling by "taps - 1" samples, both at the stage's lower
+  rate, which is 2^s times the input rate.
+*/
+gdouble btedb_oversampler_latency_for(guint factor, BtEdbOversamplerQuality quality) {
+  const guint nstages = stage_count(btedb_oversampler_round_factor(factor));
+  gdouble result = 0;
+
+  for (guint s = 0; s < nstages; ++s) {
+    result += (2.0 * stage_taps(quality, s) - 1) / (1u << s);
+  }
+
+  return result;
+}
+
+gdouble btedb_oversampler_get_latency(const BtEdbOversampler* self) {
+  return btedb_oversampler_latency_for(self->factor, self->quality);
+}
+
+/*
+  Each stage keeps 2 * taps - 1 samples of history for upsampling and as many again for downsampling, at a rate 2^s
+  times the input rate. One more frame covers rounding.
+*/
+guint btedb_oversampler_get_tail(const BtEdbOversampler* self) {
+  gdouble result = 0;
+
+  for (guint s = 0; s < self->nstages; ++s) {
+    result += 2.0 * (2 * self->stages[s].taps - 1) / (1u << s);
+  }
+
+  return (guint)ceil(result) + 1;
+}
+
+void btedb_oversampler_reset(BtEdbOversampler* self) {
+  for (guint c = 0; c < self->channels; ++c) {
+    memset(self->channel_state[c].storage, 0, self->channel_state[c].storage_len * sizeof(gfloat));
+  }
+}
+
+void btedb_oversampler_process(
+  BtEdbOversampler* self, guint channel, gfloat* data, guint stride, guint nframes,
+  BtEdbOversamplerFunc func, gpointer user_data) {
+  btedb_oversampler_process_to(self, channel, data, data, stride, nframes, func, user_data);
+}
+
+// Upsamples "n" frames in ch->work[0] through every stage, and returns the buffer holding the result.
+static gfloat* upsample_block(const BtEdbOversampler* const self, Channel* const ch, guint n) {
+  gfloat* src = ch->work[0];
+  gfloat* dst = ch->work[1];
+  guint len = n;
+
+  for (guint s = 0; s < self->nstages; ++s) {
+    upsample(&self->stages[s], ch->up[s], src, dst, len);
+    len *= 2;
+    gfloat* const tmp = src; src = dst; dst = tmp;
+  }
+
+  return src;
+}
+
+/*
+  Downsamples "n * factor" samples in "data" back to "n" frames through every stage. Each stage reads all of its input
+  before writing, so it's done in place.
+ */
+static void downsample_block(const BtEdbOversampler* const self, Channel* const ch, gfloat* const data, guint n) {
+  guint len = n * self->factor;
+
+  for (gint s = self->nstages - 1; s >= 0; --s) {
+    len /= 2;
+    downsample(&self->stages[s], ch->down_even[s], ch->down_odd[s], data, data, len);
+  }
+}
+
+void btedb_oversampler_process_to(
+  BtEdbOversampler* self, guint channel, const gfloat* in, gfloat* out, guint stride, guint nframes,
+  BtEdbOversamplerFunc func, gpointer user_data) {
+
+  g_assert(channel < self->channels);
+  Channel* const ch = &self->channel_state[channel];
+
+  for (guint done = 0; done < nframes; done += BLOCK_FRAMES) {
+    const guint n = MIN(BLOCK_FRAMES, nframes - done);
+
+    for (guint i = 0; i < n; ++i) {
+      ch->work[0][i] = in[(done + i) * stride];
+    }
+
+    gfloat* const data = upsample_block(self, ch, n);
+    func(user_data, data, n * self->factor);
+    downsample_block(self, ch, data, n);
+
+    for (guint i = 0; i < n; ++i) {
+      out[(done + i) * stride] = data[i];
+    }
+  }
+}
+
+void btedb_oversampler_upsample(BtEdbOversampler* self, guint channel, const gfloat* in, gfloat* out, guint nframes) {
+  g_assert(channel < self->channels);
+  Channel* const ch = &self->channel_state[channel];
+
+  for (guint done = 0; done < nframes; done += BLOCK_FRAMES) {
+    const guint n = MIN(BLOCK_FRAMES, nframes - done);
+
+    memcpy(ch->work[0], in + done, n * sizeof(gfloat));
+    memcpy(out + (gsize)done * self->factor, upsample_block(self, ch, n), n * self->factor * sizeof(gfloat));
+  }
+}
+
+void btedb_oversampler_downsample(BtEdbOversampler* self, guint channel, gfloat* data, gfloat* out, guint nframes) {
+  g_assert(channel < self->channels);
+  Channel* const ch = &self->channel_state[channel];
+
+  for (guint done = 0; done < nframes; done += BLOCK_FRAMES) {
+    const guint n = MIN(BLOCK_FRAMES, nframes - done);
+    gfloat* const block = data + (gsize)done * self->factor;
+
+    downsample_block(self, ch, block, n);
+    memcpy(out + done, block, n * sizeof(gfloat));
+  }
+}
@@ -0,0 +1,97 @@
+/*
+  Distort effect for Buzztrax
+  Copyright (C) 2020 David Beswick
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <glib.h>
+
+typedef struct _BtEdbOversampler BtEdbOversampler;
+
+typedef enum {
+  // Long filters with a flat passband to 0.45 * rate, and roughly 100dB of image rejection.
+  BTEDB_OVERSAMPLER_QUALITY_HIGH,
+  // Short filters, flat to 0.35 * rate with about 70dB of rejection beyond 0.65 * rate, for a quarter of the latency.
+  BTEDB_OVERSAMPLER_QUALITY_LOW_LATENCY
+} BtEdbOversamplerQuality;
+
+typedef void (*BtEdbOversamplerFunc)(gpointer user_data, gfloat* data, guint nsamples);
+
+/*
+  Oversampling by cascaded half-band FIR stages, each of which doubles the rate.
+
+  Audio is processed in small blocks. Each block is upsampled through every stage, passed to a callback at the
+  oversampled rate and then downsampled back through the stages, so that the whole round trip stays in cache.
+
+  "factor" is rounded up to a power of two. Each channel has its own filter state, and channels may be processed
+  concurrently by different threads. Filter coefficients are shared by all oversamplers with the same factor and
+  quality.
+*/
+BtEdbOversampler* btedb_oversampler_new(guint factor, guint channels, BtEdbOversamplerQuality quality);
+void btedb_oversampler_free(BtEdbOversampler* self);
+
+guint btedb_oversampler_get_factor(const BtEdbOversampler* self);
+guint btedb_oversampler_get_channels(const BtEdbOversampler* self);
+BtEdbOversamplerQuality btedb_oversampler_get_quality(const BtEdbOversampler* self);
+
+/*
+  The delay from input to output, in samples at the input rate. All stages are linear phase, so this is the group
+  delay at every frequency. It may be fractional.
+*/
+gdouble btedb_oversampler_get_latency(const BtEdbOversampler* self);
+gdouble btedb_oversampler_latency_for(guint factor, BtEdbOversamplerQuality quality);
+
+/*
+  The number of frames of silence after which the filter state is all zeros, so that the output is exactly silent and
+  stays that way until there is input again.
+*/
+guint btedb_oversampler_get_tail(const BtEdbOversampler* self);
+
+// Clears all filter state, as if the oversampler had only ever seen silence.
+void btedb_oversampler_reset(BtEdbOversampler* self);
+
+/*
+  Processes "nframes" samples of one channel in-place. Consecutive samples are "stride" values apart, so interleaved
+  audio can be processed without copying it.
+*/
+void btedb_oversampler_process(
+  BtEdbOversampler* self, guint channel, gfloat* data, guint stride, guint nframes,
+  BtEdbOversamplerFunc func, gpointer user_data);
+
+/*
+  As btedb_oversampler_process, but reads from "in" and writes to "out", which have the same stride. The input is
+  only read once, so it can be distorted into a new buffer without copying it first.
+*/
+void btedb_oversampler_process_to(
+  BtEdbOversampler* self, guint channel, const gfloat* in, gfloat* out, guint stride, guint nframes,
+  BtEdbOversamplerFunc func, gpointer user_data);
+
+/*
+  The two halves of btedb_oversampler_process, for running on different threads. btedb_oversampler_upsample turns
+  "nframes" contiguous samples into "nframes * factor" samples in "out". btedb_oversampler_downsample turns them back
+  into "nframes" samples in "out", overwriting "data" as it goes. Upsampling and downsampling have separate filter
+  state, so the same channel may be upsampled and downsampled at the same time, but neither may run alongside
+  btedb_oversampler_process.
+*/
+void btedb_oversampler_upsample(BtEdbOversampler* self, guint channel, const gfloat* in, gfloat* out, guint nframes);
+void btedb_oversampler_downsample(BtEdbOversampler* self, guint channel, gfloat* data, gfloat* out, guint nframes);
+
+// The memory taken by the filter coefficients shared between all the oversamplers in the process, in bytes.
+gsize btedb_oversampler_get_shared_bytes(void);
+
+// Rounds "factor" up to the factor that the oversampler will actually use.
+guint btedb_oversampler_round_factor(guint factor);
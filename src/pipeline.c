@@ -0,0 +1,335 @@
+/*
+  Distort effect for Buzztrax
+  Copyright (C) 2020 David Beswick
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+#include "config.h"
+#include "src/pipeline.h"
+#include "src/denormals.h"
+
+#include <string.h>
+
+#define BLOCK_FRAMES BTEDB_PIPELINE_BLOCK_FRAMES
+
+/*
+  Blocks in the ring. The caller can always write a block more than the delay before it must read, and there's one
+  more for the block being read, so that neither waits on the other.
+*/
+#define BLOCKS (BTEDB_PIPELINE_DELAY_FRAMES / BLOCK_FRAMES + 2)
+
+/*
+  A count of blocks that one thread has finished with, which the next thread waits on. Only the waiting thread takes
+  the lock, and then only to sleep. The thread advancing the count only takes it to wake a thread that's sleeping.
+*/
+typedef struct {
+  gint value;
+  gint waiting;
+  GMutex lock;
+  GCond cond;
+} Counter;
+
+typedef struct {
+  // Each channel's input, which the output replaces once it's been downsampled.
+  gfloat* frames;
+  // Each channel at the oversampled rate.
+  gfloat* oversampled;
+  gpointer data;
+} Block;
+
+// A thread that takes blocks once they've been counted by "in", and counts them with "out" when it's done.
+typedef struct {
+  BtEdbPipeline* pipeline;
+  Counter* in;
+  Counter* out;
+  void (*func)(BtEdbPipeline* pipeline, Block* block);
+  GThread* thread;
+} Stage;
+
+struct _BtEdbPipeline {
+  guint channels;
+  BtEdbSampleFormat format;
+  BtEdbPipelineDistortFunc func;
+  gpointer user_data;
+  GDestroyNotify block_data_clear;
+  /*
+    Only changed while the pipeline is idle. Stages read it after waiting on their counter, which orders the read after
+    the change.
+  */
+  BtEdbOversampler* oversampler;
+  guint factor;
+  Block blocks[BLOCKS];
+
+  // Whole blocks written by the caller, and finished by each stage.
+  Counter written;
+  Counter upsampled;
+  Counter distorted;
+  Counter downsampled;
+  Stage stages[3];
+  gint stop;
+
+  // Only used by the caller. Frames written and read in total, and frames of silence still to be read first.
+  guint64 write_pos;
+  guint64 read_pos;
+  guint lead;
+};
+
+static void counter_init(Counter* const counter) {
+  counter->value = 0;
+  counter->waiting = FALSE;
+  g_mutex_init(&counter->lock);
+  g_cond_init(&counter->cond);
+}
+
+static void counter_clear(Counter* const counter) {
+  g_mutex_clear(&counter->lock);
+  g_cond_clear(&counter->cond);
+}
+
+// True if "value" has reached "target". Counts wrap, and are never more than the ring's size apart.
+static inline gboolean counter_reached(guint value, guint target) {
+  return (gint)(value - target) >= 0;
+}
+
+static void counter_advance(Counter* const counter) {
+  g_atomic_int_inc(&counter->value);
+
+  /*
+    Both this and counter_wait store before they load, so if the waiter hasn't seen the new value then this sees that
+    it's waiting. The waiter holds the lock until it sleeps, so the signal can't arrive too early.
+  */
+  if (g_atomic_int_get(&counter->waiting)) {
+    g_mutex_lock(&counter->lock);
+    g_cond_signal(&counter->cond);
+    g_mutex_unlock(&counter->lock);
+  }
+}
+
+// Waits until the counter reaches "target". Returns FALSE if the pipeline is stopped first.
+static gboolean counter_wait(Counter* const counter, guint target, const gint* stop) {
+  if (counter_reached(g_atomic_int_get(&counter->value), target))
+    return TRUE;
+
+  g_mutex_lock(&counter->lock);
+  g_atomic_int_set(&counter->waiting, TRUE);
+  while (!counter_reached(g_atomic_int_get(&counter->value), target) && !g_atomic_int_get(stop))
+    g_cond_wait(&counter->cond, &counter->lock);
+  g_atomic_int_set(&counter->waiting, FALSE);
+  g_mutex_unlock(&counter->lock);
+
+  return counter_reached(g_atomic_int_get(&counter->value), target);
+}
+
+static void counter_wake(Counter* const counter) {
+  g_mutex_lock(&counter->lock);
+  g_cond_broadcast(&counter->cond);
+  g_mutex_unlock(&counter->lock);
+}
+
+static void stage_upsample(BtEdbPipeline* const self, Block* const block) {
+  for (guint c = 0; c < self->channels; ++c) {
+    btedb_oversampler_upsample(
+      self->oversampler, c, block->frames + c * BLOCK_FRAMES,
+      block->oversampled + (gsize)c * BLOCK_FRAMES * self->factor, BLOCK_FRAMES);
+  }
+}
+
+static void stage_distort(BtEdbPipeline* const self, Block* const block) {
+  for (guint c = 0; c < self->channels; ++c) {
+    self->func(
+      self->user_data, block->data, c, block->oversampled + (gsize)c * BLOCK_FRAMES * self->factor,
+      BLOCK_FRAMES * self->factor);
+  }
+}
+
+static void stage_downsample(BtEdbPipeline* const self, Block* const block) {
+  for (guint c = 0; c < self->channels; ++c) {
+    btedb_oversampler_downsample(
+      self->oversampler, c, block->oversampled + (gsize)c * BLOCK_FRAMES * self->factor,
+      block->frames + c * BLOCK_FRAMES, BLOCK_FRAMES);
+  }
+}
+
+static gpointer stage_main(gpointer data) {
+  Stage* const stage = (Stage*)data;
+  BtEdbPipeline* const self = stage->pipeline;
+
+  // The thread is the pipeline's own, so the setting doesn't need to be restored.
+  btedb_denormals_disable();
+
+  for (guint done = 0; counter_wait(stage->in, done + 1, &self->stop); ++done) {
+    stage->func(self, &self->blocks[done % BLOCKS]);
+    counter_advance(stage->out);
+  }
+
+  return NULL;
+}
+
+static void blocks_alloc_oversampled(BtEdbPipeline* const self) {
+  for (guint i = 0; i < BLOCKS; ++i) {
+    g_free(self->blocks[i].oversampled);
+    self->blocks[i].oversampled = g_new(gfloat, (gsize)self->channels * BLOCK_FRAMES * self->factor);
+  }
+}
+
+BtEdbPipeline* btedb_pipeline_new(
+  BtEdbOversampler* oversampler, BtEdbSampleFormat format, gsize block_data_size, GDestroyNotify block_data_clear,
+  BtEdbPipelineDistortFunc func, gpointer user_data) {
+
+  BtEdbPipeline* const self = g_new0(BtEdbPipeline, 1);
+  self->channels = btedb_oversampler_get_channels(oversampler);
+  self->format = format;
+  self->func = func;
+  self->user_data = user_data;
+  self->block_data_clear = block_data_clear;
+  self->oversampler = oversampler;
+  self->factor = btedb_oversampler_get_factor(oversampler);
+  self->lead = BTEDB_PIPELINE_DELAY_FRAMES;
+
+  for (guint i = 0; i < BLOCKS; ++i) {
+    self->blocks[i].frames = g_new(gfloat, (gsize)self->channels * BLOCK_FRAMES);
+    self->blocks[i].data = g_malloc0(block_data_size);
+  }
+  blocks_alloc_oversampled(self);
+
+  counter_init(&self->written);
+  counter_init(&self->upsampled);
+  counter_init(&self->distorted);
+  counter_init(&self->downsampled);
+
+  const Stage stages[] = {
+    { self, &self->written, &self->upsampled, stage_upsample },
+    { self, &self->upsampled, &self->distorted, stage_distort },
+    { self, &self->distorted, &self->downsampled, stage_downsample }
+  };
+  static const gchar* const names[] = { "bt-edb-upsample", "bt-edb-distort", "bt-edb-downsample" };
+
+  for (guint i = 0; i < G_N_ELEMENTS(self->stages); ++i) {
+    self->stages[i] = stages[i];
+    self->stages[i].thread = g_thread_new(names[i], stage_main, &self->stages[i]);
+  }
+
+  return self;
+}
+
+void btedb_pipeline_free(BtEdbPipeline* self) {
+  g_atomic_int_set(&self->stop, TRUE);
+
+  for (guint i = 0; i < G_N_ELEMENTS(self->stages); ++i) {
+    counter_wake(self->stages[i].in);
+    g_thread_join(self->stages[i].thread);
+  }
+
+  counter_clear(&self->written);
+  counter_clear(&self->upsampled);
+  counter_clear(&self->distorted);
+  counter_clear(&self->downsampled);
+
+  for (guint i = 0; i < BLOCKS; ++i) {
+    g_free(self->blocks[i].frames);
+    g_free(self->blocks[i].oversampled);
+    if (self->block_data_clear)
+      self->block_data_clear(self->blocks[i].data);
+    g_free(self->blocks[i].data);
+  }
+
+  g_free(self);
+}
+
+/*
+  Output is only written where input has already been read, so "sources" and "channels" may be the same. Writing
+  stops when the ring is full, and reading when the next output depends on a block that isn't whole yet. As the delay
+  is at least a block and is less than the ring, one or the other can always go on.
+ */
+void btedb_pipeline_process(
+  BtEdbPipeline* self, guint8* const* sources, guint8* const* channels, guint stride, guint nframes,
+  BtEdbPipelineBlockFunc func, gpointer user_data) {
+
+  const guint size = btedb_sample_format_size(self->format);
+  guint written = 0;
+  guint read = 0;
+
+  while (read < nframes) {
+    while (written < nframes && self->write_pos / BLOCK_FRAMES - self->read_pos / BLOCK_FRAMES < BLOCKS) {
+      const guint offset = self->write_pos % BLOCK_FRAMES;
+      const guint n = MIN(BLOCK_FRAMES - offset, nframes - written);
+      Block* const block = &self->blocks[self->write_pos / BLOCK_FRAMES % BLOCKS];
+
+      if (offset == 0)
+        func(user_data, block->data, written);
+
+      for (guint c = 0; c < self->channels; ++c) {
+        btedb_samples_to_float(
+          self->format, sources[c] + (gsize)written * stride * size, stride,
+          block->frames + c * BLOCK_FRAMES + offset, n);
+      }
+
+      self->write_pos += n;
+      written += n;
+      if (self->write_pos % BLOCK_FRAMES == 0)
+        counter_advance(&self->written);
+    }
+
+    if (self->lead > 0) {
+      const guint n = MIN(self->lead, written - read);
+
+      for (guint c = 0; c < self->channels; ++c) {
+        for (guint i = 0; i < n; ++i) {
+          memset(channels[c] + (gsize)(read + i) * stride * size, 0, size);
+        }
+      }
+
+      self->lead -= n;
+      read += n;
+    } else if (self->read_pos / BLOCK_FRAMES < self->write_pos / BLOCK_FRAMES) {
+      const guint64 index = self->read_pos / BLOCK_FRAMES;
+      const guint offset = self->read_pos % BLOCK_FRAMES;
+      const guint n = MIN(BLOCK_FRAMES - offset, written - read);
+      const Block* const block = &self->blocks[index % BLOCKS];
+
+      counter_wait(&self->downsampled, (guint)(index + 1), &self->stop);
+
+      for (guint c = 0; c < self->channels; ++c) {
+        btedb_samples_from_float(
+          self->format, block->frames + c * BLOCK_FRAMES + offset, channels[c] + (gsize)read * stride * size, stride,
+          n);
+      }
+
+      self->read_pos += n;
+      read += n;
+    }
+  }
+}
+
+void btedb_pipeline_wait_idle(BtEdbPipeline* self) {
+  counter_wait(&self->downsampled, (guint)(self->write_pos / BLOCK_FRAMES), &self->stop);
+}
+
+guint btedb_pipeline_get_pending(const BtEdbPipeline* self) {
+  return self->write_pos % BLOCK_FRAMES;
+}
+
+void btedb_pipeline_set_oversampler(BtEdbPipeline* self, BtEdbOversampler* oversampler) {
+  g_assert(btedb_oversampler_get_channels(oversampler) == self->channels);
+
+  btedb_pipeline_wait_idle(self);
+
+  self->oversampler = oversampler;
+  if (btedb_oversampler_get_factor(oversampler) != self->factor) {
+    self->factor = btedb_oversampler_get_factor(oversampler);
+    blocks_alloc_oversampled(self);
+  }
+}
@@ -0,0 +1,84 @@
+/*
+  Distort effect for Buzztrax
+  Copyright (C) 2020 David Beswick
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+#pragma once
+
+#include "src/oversampler.h"
+#include "src/sample_format.h"
+
+typedef struct _BtEdbPipeline BtEdbPipeline;
+
+// Audio passes through the pipeline in blocks of this many frames.
+#define BTEDB_PIPELINE_BLOCK_FRAMES 64
+// The delay added by the pipeline, in frames.
+#define BTEDB_PIPELINE_DELAY_FRAMES (4 * BTEDB_PIPELINE_BLOCK_FRAMES)
+
+/*
+  Called on the caller's thread as each block is started, to fill in "block_data" for it. "frame" is the offset of the
+  block's first frame within the current call to btedb_pipeline_process.
+*/
+typedef void (*BtEdbPipelineBlockFunc)(gpointer user_data, gpointer block_data, guint frame);
+
+/*
+  Called on the pipeline's distortion thread with one channel of a block at the oversampled rate, to be processed in
+  place.
+*/
+typedef void (*BtEdbPipelineDistortFunc)(
+  gpointer user_data, gconstpointer block_data, guint channel, gfloat* data, guint nsamples);
+
+/*
+  Runs upsampling, distortion and downsampling on three threads of their own, so that each stage only needs a core to
+  itself, rather than the whole job fitting on one. Blocks are handed from stage to stage around a fixed ring. Each
+  stage publishes its progress through a counter that no other thread writes, so no locks are taken while there's
+  work to do, and a stage only sleeps when it's caught up with the one before.
+
+  Output is delayed by BTEDB_PIPELINE_DELAY_FRAMES, plus the oversampler's own latency, so that the stages can work
+  on the end of one buffer while the next is on its way. The first frames out are silence.
+
+  Each block carries "block_data_size" bytes of data for the distortion, set when the block is started. Unless it's
+  NULL, "block_data_clear" is called on each block's data when the pipeline is freed, to release anything it holds.
+*/
+BtEdbPipeline* btedb_pipeline_new(
+  BtEdbOversampler* oversampler, BtEdbSampleFormat format, gsize block_data_size, GDestroyNotify block_data_clear,
+  BtEdbPipelineDistortFunc func, gpointer user_data);
+void btedb_pipeline_free(BtEdbPipeline* self);
+
+/*
+  Passes "nframes" frames from "sources" through the pipeline, and writes the same number of delayed frames to
+  "channels". Both hold the address of each channel's first sample, in the pipeline's format, with consecutive samples
+  "stride" samples apart. They may be the same. Returns once all of the output has been written.
+*/
+void btedb_pipeline_process(
+  BtEdbPipeline* self, guint8* const* sources, guint8* const* channels, guint stride, guint nframes,
+  BtEdbPipelineBlockFunc func, gpointer user_data);
+
+// Waits until every whole block of input has been through every stage.
+void btedb_pipeline_wait_idle(BtEdbPipeline* self);
+
+/*
+  Frames of input that are waiting for the rest of their block, and haven't been through any stage yet. They'll be
+  processed with the oversampler that's in use when their block is finished.
+*/
+guint btedb_pipeline_get_pending(const BtEdbPipeline* self);
+
+/*
+  Switches to another oversampler with the same channel count, once the pipeline is idle. The old one is no longer used
+  by the time this returns.
+*/
+void btedb_pipeline_set_oversampler(BtEdbPipeline* self, BtEdbOversampler* oversampler);
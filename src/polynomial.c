@@ -0,0 +1,218 @@
+/*
+  Distort effect for Buzztrax
+  Copyright (C) 2020 David Beswick
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+#include "config.h"
+#include "src/polynomial.h"
+#include "src/oversampler.h"
+
+#include <math.h>
+#include <string.h>
+
+// The highest degree fitted. Higher degrees cost more per sample, and need higher oversampling factors.
+#define MAX_DEGREE 63
+
+/*
+  The curve is sampled at this many Chebyshev nodes. That's far more than the degree, so that the coefficients aren't
+  disturbed by the harmonics above MAX_DEGREE.
+*/
+#define NODES 512
+
+// Harmonics quieter than this, relative to the largest output, are left out. -60dB.
+#define HARMONIC_FLOOR 1e-3
+
+// The top of the oversampler's passband, as a fraction of the sample rate.
+#define PASSBAND 0.45
+
+// Samples are evaluated in blocks of this size, so that the loop over samples is the inner one and vectorizes.
+#define PROCESS_BLOCK 64
+
+struct _BtEdbPolynomial {
+  gint refcount;
+
+  BtEdbDistortParams params;
+  guint degree;
+  gdouble error;
+  // The largest output of the curve, for input from -1 to 1.
+  gdouble scale;
+  gfloat coeffs[MAX_DEGREE + 1];
+};
+
+// The curve at "n" points, in double precision, so that the fit is as close as possible to "exact" mode.
+static void curve(const BtEdbDistortParams* const params, gdouble* data, guint n) {
+  BtEdbGainRamp gains;
+  btedb_gain_ramp_init(&gains, params);
+  btedb_kernel_f64(params, &gains, data, n);
+}
+
+// Evaluates the polynomial at one point, in double precision, by Clenshaw's recurrence.
+static gdouble evaluate(const BtEdbPolynomial* const self, gdouble x) {
+  gdouble b1 = 0;
+  gdouble b2 = 0;
+
+  for (guint k = self->degree; k > 0; --k) {
+    const gdouble b0 = 2 * x * b1 - b2 + self->coeffs[k];
+    b2 = b1;
+    b1 = b0;
+  }
+
+  return x * b1 - b2 + self->coeffs[0];
+}
+
+BtEdbPolynomial* btedb_polynomial_new(const BtEdbDistortParams* params) {
+  BtEdbPolynomial* const self = g_new0(BtEdbPolynomial, 1);
+  self->refcount = 1;
+  self->params = *params;
+
+  gdouble* const values = g_new(gdouble, NODES);
+  for (guint j = 0; j < NODES; ++j) {
+    values[j] = cos(G_PI * (j + 0.5) / NODES);
+  }
+  curve(params, values, NODES);
+
+  gdouble scale = 0;
+  for (guint j = 0; j < NODES; ++j) {
+    scale = MAX(scale, fabs(values[j]));
+  }
+  self->scale = scale;
+
+  /*
+    For a full scale sine, x = cos(theta), and T_k(cos(theta)) = cos(k * theta). So coefficient k is exactly the
+    amplitude of the kth harmonic.
+  */
+  for (guint k = 0; k <= MAX_DEGREE; ++k) {
+    gdouble acc = 0;
+    for (guint j = 0; j < NODES; ++j) {
+      acc += values[j] * cos(G_PI * k * (j + 0.5) / NODES);
+    }
+    self->coeffs[k] = (k == 0 ? 1.0 : 2.0) * acc / NODES;
+
+    if (fabs(self->coeffs[k]) >= scale * HARMONIC_FLOOR)
+      self->degree = k;
+  }
+
+  g_free(values);
+
+  /*
+    When loud harmonics above the limit are cut off, the polynomial overshoots and ripples around the curve, so that
+    the output wobbles as the input rises. Jackson's damping factors keep it monotonic and within the curve's range,
+    at the cost of a softer knee.
+  */
+  if (self->degree == MAX_DEGREE) {
+    const gdouble q = G_PI / (MAX_DEGREE + 1);
+    for (guint k = 1; k <= MAX_DEGREE; ++k) {
+      self->coeffs[k] *= ((MAX_DEGREE + 1 - k) * cos(q * k) + sin(q * k) / tan(q)) / (MAX_DEGREE + 1);
+    }
+  }
+
+  // The error is measured between the nodes too, where it's largest.
+  gdouble points[4 * NODES + 1];
+  for (guint i = 0; i < G_N_ELEMENTS(points); ++i) {
+    points[i] = 2.0 * i / (G_N_ELEMENTS(points) - 1) - 1;
+  }
+  gdouble exact[G_N_ELEMENTS(points)];
+  memcpy(exact, points, sizeof(points));
+  curve(params, exact, G_N_ELEMENTS(exact));
+
+  for (guint i = 0; i < G_N_ELEMENTS(points); ++i) {
+    self->error = MAX(self->error, fabs(evaluate(self, points[i]) - exact[i]));
+  }
+
+  return self;
+}
+
+BtEdbPolynomial* btedb_polynomial_ref(BtEdbPolynomial* self) {
+  g_atomic_int_inc(&self->refcount);
+  return self;
+}
+
+void btedb_polynomial_unref(BtEdbPolynomial* self) {
+  if (g_atomic_int_dec_and_test(&self->refcount))
+    g_free(self);
+}
+
+gboolean btedb_polynomial_matches(const BtEdbPolynomial* self, const BtEdbDistortParams* params) {
+  return memcmp(&self->params, params, sizeof(*params)) == 0;
+}
+
+guint btedb_polynomial_get_degree(const BtEdbPolynomial* self) {
+  return self->degree;
+}
+
+gdouble btedb_polynomial_get_error(const BtEdbPolynomial* self) {
+  return self->error;
+}
+
+gboolean btedb_polynomial_is_accurate(const BtEdbPolynomial* self) {
+  return self->error <= self->scale * BTEDB_POLYNOMIAL_TOLERANCE;
+}
+
+/*
+  Harmonic N of a frequency f is at N * f. At a factor of F, it appears at F - N * f if that's beyond the oversampled
+  Nyquist frequency, in units of the sample rate. That must be at least PASSBAND for every f up to PASSBAND.
+*/
+guint btedb_polynomial_get_oversample(const BtEdbPolynomial* self) {
+  return btedb_oversampler_round_factor((guint)ceil((self->degree + 1) * PASSBAND));
+}
+
+void btedb_polynomial_process(const BtEdbPolynomial* self, gfloat* data, guint nsamples) {
+  for (guint done = 0; done < nsamples; done += PROCESS_BLOCK) {
+    const guint n = MIN(PROCESS_BLOCK, nsamples - done);
+    gfloat* const x = data + done;
+    gfloat b1[PROCESS_BLOCK];
+    gfloat b2[PROCESS_BLOCK];
+
+    /*
+      The polynomial only follows the curve from -1 to 1, and grows without limit beyond that. Input past full scale
+      is put aside and computed exactly, as in the other modes.
+    */
+    gfloat outside[PROCESS_BLOCK];
+    guint outside_index[PROCESS_BLOCK];
+    guint noutside = 0;
+
+    for (guint i = 0; i < n; ++i) {
+      if (G_UNLIKELY(fabsf(x[i]) > 1)) {
+        outside[noutside] = x[i];
+        outside_index[noutside++] = i;
+      }
+      x[i] = CLAMP(x[i], -1.0f, 1.0f);
+      b1[i] = 0;
+      b2[i] = 0;
+    }
+
+    for (guint k = self->degree; k > 0; --k) {
+      const gfloat c = self->coeffs[k];
+      for (guint i = 0; i < n; ++i) {
+        const gfloat b0 = 2 * x[i] * b1[i] - b2[i] + c;
+        b2[i] = b1[i];
+        b1[i] = b0;
+      }
+    }
+
+    for (guint i = 0; i < n; ++i) {
+      x[i] = x[i] * b1[i] - b2[i] + self->coeffs[0];
+    }
+
+    if (noutside > 0) {
+      btedb_kernel_scalar(&self->params, outside, noutside);
+      for (guint i = 0; i < noutside; ++i) {
+        x[outside_index[i]] = outside[i];
+      }
+    }
+  }
+}
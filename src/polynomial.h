@@ -0,0 +1,66 @@
+/*
+  Distort effect for Buzztrax
+  Copyright (C) 2020 David Beswick
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+#pragma once
+
+#include "src/kernel.h"
+
+typedef struct _BtEdbPolynomial BtEdbPolynomial;
+
+/*
+  A Chebyshev polynomial fitted to the distortion curve, for input from -1 to 1. Input beyond that is computed with
+  the exact curve.
+
+  A polynomial of degree N turns a sine into harmonics up to the Nth and no further, unlike the curve itself. So the
+  oversampling factor that keeps every harmonic from aliasing into the audible range can be worked out from the degree.
+  The degree is the smallest that includes every harmonic of a full scale sine that's louder than -60dB, up to a
+  limit. Curves with a sharp knee need more harmonics than that, and are given a softer knee instead, which can be
+  off by 10% to 50% of full scale around the knee. btedb_polynomial_is_accurate says whether that's happened.
+
+  Like BtEdbCurveTable, polynomials are immutable and reference counted so that they can be fitted on another thread.
+*/
+BtEdbPolynomial* btedb_polynomial_new(const BtEdbDistortParams* params);
+BtEdbPolynomial* btedb_polynomial_ref(BtEdbPolynomial* self);
+void btedb_polynomial_unref(BtEdbPolynomial* self);
+
+// True if the polynomial was fitted to the given settings, and so doesn't need to be fitted again.
+gboolean btedb_polynomial_matches(const BtEdbPolynomial* self, const BtEdbDistortParams* params);
+
+guint btedb_polynomial_get_degree(const BtEdbPolynomial* self);
+
+// The largest difference from the curve, for input from -1 to 1.
+gdouble btedb_polynomial_get_error(const BtEdbPolynomial* self);
+
+/*
+  The largest error that a polynomial may have, relative to the curve's largest output, and still stand in for it.
+  Polynomials within the degree limit are off by up to about 1%.
+*/
+#define BTEDB_POLYNOMIAL_TOLERANCE 0.02
+
+// True if the error is within BTEDB_POLYNOMIAL_TOLERANCE.
+gboolean btedb_polynomial_is_accurate(const BtEdbPolynomial* self);
+
+/*
+  The smallest power of two oversampling factor at which no harmonic of anything below 0.45 times the sample rate,
+  which is the top of the internal oversampler's passband, aliases back below that frequency. Those that pass the
+  oversampled Nyquist frequency fold back into the band that downsampling removes.
+*/
+guint btedb_polynomial_get_oversample(const BtEdbPolynomial* self);
+
+void btedb_polynomial_process(const BtEdbPolynomial* self, gfloat* data, guint nsamples);
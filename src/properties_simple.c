@@ -20,9 +20,10 @@
 #include <stdio.h>
 
 struct _BtEdbPropertiesSimple {
-  GObject parent;
   GObject* owner;
   GArray* props;
+  // Indexed by prop_id. Each entry is an index into "props" plus one, or zero if it hasn't been looked up yet.
+  GArray* by_id;
 };
 
 typedef struct {
@@ -30,70 +31,88 @@ typedef struct {
   void* var;
 } PspecVar;
 
-gboolean btedb_properties_simple_get(const BtEdbPropertiesSimple* self, GParamSpec* pspec, GValue* value) {
+/*
+  A property's prop_id isn't known until it's first used, so the first lookup of each property searches for its pspec
+  and remembers where it was found.
+*/
+static const PspecVar* lookup(BtEdbPropertiesSimple* self, guint prop_id, GParamSpec* pspec) {
+  if (prop_id < self->by_id->len) {
+	const guint index = g_array_index(self->by_id, guint, prop_id);
+	if (index && g_array_index(self->props, PspecVar, index - 1).pspec == pspec)
+	  return &g_array_index(self->props, PspecVar, index - 1);
+  }
+
   for (guint i = 0; i < self->props->len; ++i) {
-	PspecVar* const pspec_var = &g_array_index(self->props, PspecVar, i);
-	
-	if (pspec_var->pspec->name == pspec->name) {
-	  switch (pspec_var->pspec->value_type) {
-	  case G_TYPE_BOOLEAN:
-		g_value_set_boolean(value, *(gint*)pspec_var->var);
-		break;
-	  case G_TYPE_INT:
-		g_value_set_int(value, *(gint*)pspec_var->var);
-		break;
-	  case G_TYPE_UINT:
-		g_value_set_uint(value, *(guint*)pspec_var->var);
-		break;
-	  case G_TYPE_FLOAT:
-		g_value_set_float(value, *(gfloat*)pspec_var->var);
-		break;
-	  case G_TYPE_DOUBLE:
-		g_value_set_double(value, *(gdouble*)pspec_var->var);
-		break;
-	  default:
-		if (g_type_is_a(pspec_var->pspec->value_type, G_TYPE_ENUM))
-		  g_value_set_enum(value, *(guint*)pspec_var->var);
-		else
-		  g_assert(FALSE);
-	  }
-	  return TRUE;
+	if (g_array_index(self->props, PspecVar, i).pspec == pspec) {
+	  if (prop_id >= self->by_id->len)
+		g_array_set_size(self->by_id, prop_id + 1);
+	  g_array_index(self->by_id, guint, prop_id) = i + 1;
+	  return &g_array_index(self->props, PspecVar, i);
 	}
   }
-  return FALSE;
+
+  return NULL;
 }
 
-gboolean btedb_properties_simple_set(const BtEdbPropertiesSimple* self, GParamSpec* pspec, const GValue* value) {
-  for (guint i = 0; i < self->props->len; ++i) {
-	PspecVar* const pspec_var = &g_array_index(self->props, PspecVar, i);
-	
-	if (pspec_var->pspec == pspec) {
-	  switch (pspec_var->pspec->value_type) {
-	  case G_TYPE_BOOLEAN:
-		(*(gint*)pspec_var->var) = g_value_get_boolean(value);
-		break;
-	  case G_TYPE_INT:
-		(*(gint*)pspec_var->var) = g_value_get_int(value);
-		break;
-	  case G_TYPE_UINT:
-		(*(guint*)pspec_var->var) = g_value_get_uint(value);
-		break;
-	  case G_TYPE_FLOAT:
-		(*(gfloat*)pspec_var->var) = g_value_get_float(value);
-		break;
-	  case G_TYPE_DOUBLE:
-		(*(gdouble*)pspec_var->var) = g_value_get_double(value);
-		break;
-	  default:
-		if (g_type_is_a(pspec_var->pspec->value_type, G_TYPE_ENUM))
-		  (*(guint*)pspec_var->var) = g_value_get_enum(value);
-		else
-		  g_assert(FALSE);
-	  }
-	  return TRUE;
-	}
+gboolean btedb_properties_simple_get(BtEdbPropertiesSimple* self, guint prop_id, GParamSpec* pspec, GValue* value) {
+  const PspecVar* const pspec_var = lookup(self, prop_id, pspec);
+  if (!pspec_var)
+	return FALSE;
+
+  switch (pspec_var->pspec->value_type) {
+  case G_TYPE_BOOLEAN:
+	g_value_set_boolean(value, *(gint*)pspec_var->var);
+	break;
+  case G_TYPE_INT:
+	g_value_set_int(value, *(gint*)pspec_var->var);
+	break;
+  case G_TYPE_UINT:
+	g_value_set_uint(value, *(guint*)pspec_var->var);
+	break;
+  case G_TYPE_FLOAT:
+	g_value_set_float(value, *(gfloat*)pspec_var->var);
+	break;
+  case G_TYPE_DOUBLE:
+	g_value_set_double(value, *(gdouble*)pspec_var->var);
+	break;
+  default:
+	if (g_type_is_a(pspec_var->pspec->value_type, G_TYPE_ENUM))
+	  g_value_set_enum(value, *(guint*)pspec_var->var);
+	else
+	  g_assert(FALSE);
+  }
+  return TRUE;
+}
+
+gboolean btedb_properties_simple_set(
+  BtEdbPropertiesSimple* self, guint prop_id, GParamSpec* pspec, const GValue* value) {
+  const PspecVar* const pspec_var = lookup(self, prop_id, pspec);
+  if (!pspec_var)
+	return FALSE;
+
+  switch (pspec_var->pspec->value_type) {
+  case G_TYPE_BOOLEAN:
+	(*(gint*)pspec_var->var) = g_value_get_boolean(value);
+	break;
+  case G_TYPE_INT:
+	(*(gint*)pspec_var->var) = g_value_get_int(value);
+	break;
+  case G_TYPE_UINT:
+	(*(guint*)pspec_var->var) = g_value_get_uint(value);
+	break;
+  case G_TYPE_FLOAT:
+	(*(gfloat*)pspec_var->var) = g_value_get_float(value);
+	break;
+  case G_TYPE_DOUBLE:
+	(*(gdouble*)pspec_var->var) = g_value_get_double(value);
+	break;
+  default:
+	if (g_type_is_a(pspec_var->pspec->value_type, G_TYPE_ENUM))
+	  (*(guint*)pspec_var->var) = g_value_get_enum(value);
+	else
+	  g_assert(FALSE);
   }
-  return FALSE;
+  return TRUE;
 }
 	
 void btedb_properties_simple_add(BtEdbPropertiesSimple* self, const char* prop_name, void* var) {
@@ -109,11 +128,15 @@ void btedb_properties_simple_add(BtEdbPropertiesSimple* self, const char* prop_n
 
 void btedb_properties_simple_free(BtEdbPropertiesSimple* self) {
   g_array_unref(self->props);
+  g_array_unref(self->by_id);
+  g_free(self);
 }
 
 BtEdbPropertiesSimple* btedb_properties_simple_new(GObject* owner) {
   BtEdbPropertiesSimple* result = g_malloc(sizeof(BtEdbPropertiesSimple));
   result->props = g_array_new(FALSE, FALSE, sizeof(PspecVar));
+  // Cleared, so that prop_ids that haven't been looked up have no entry.
+  result->by_id = g_array_new(FALSE, TRUE, sizeof(guint));
   result->owner = owner;
   return result;
 }
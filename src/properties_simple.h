@@ -24,11 +24,15 @@ typedef struct _BtEdbPropertiesSimple BtEdbPropertiesSimple;
 
 /*
   This class helps with avoiding some repetitive code around properties setting.
+
+  Properties are found by the prop_id given to the owner's get_property and set_property, so get and set take
+  constant time however many properties there are. Neither is thread-safe, as lookups are cached on first use.
 */
 BtEdbPropertiesSimple* btedb_properties_simple_new(GObject* owner);
 void btedb_properties_simple_free(BtEdbPropertiesSimple* self);
 
 void btedb_properties_simple_add(BtEdbPropertiesSimple* self, const char* prop_name, void* var);
-gboolean btedb_properties_simple_get(const BtEdbPropertiesSimple* self, GParamSpec* pspec, GValue* value);
-gboolean btedb_properties_simple_set(const BtEdbPropertiesSimple* self, GParamSpec* pspec, const GValue* value);
+gboolean btedb_properties_simple_get(BtEdbPropertiesSimple* self, guint prop_id, GParamSpec* pspec, GValue* value);
+gboolean btedb_properties_simple_set(
+  BtEdbPropertiesSimple* self, guint prop_id, GParamSpec* pspec, const GValue* value);
 
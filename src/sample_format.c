@@ -0,0 +1,91 @@
+/*
+  Distort effect for Buzztrax
+  Copyright (C) 2020 David Beswick
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "config.h"
+#include "src/sample_format.h"
+
+#include <math.h>
+
+guint btedb_sample_format_size(BtEdbSampleFormat format) {
+  switch (format) {
+  case BTEDB_SAMPLE_F32: return sizeof(gfloat);
+  case BTEDB_SAMPLE_F64: return sizeof(gdouble);
+  case BTEDB_SAMPLE_S16: return sizeof(gint16);
+  case BTEDB_SAMPLE_S32: return sizeof(gint32);
+  }
+  g_assert_not_reached();
+}
+
+void btedb_samples_to_float(BtEdbSampleFormat format, const void* src, guint stride, gfloat* dst, guint nsamples) {
+  switch (format) {
+  case BTEDB_SAMPLE_F32: {
+    const gfloat* const s = (const gfloat*)src;
+    for (guint i = 0; i < nsamples; ++i)
+      dst[i] = s[i * stride];
+    break;
+  }
+  case BTEDB_SAMPLE_F64: {
+    const gdouble* const s = (const gdouble*)src;
+    for (guint i = 0; i < nsamples; ++i)
+      dst[i] = s[i * stride];
+    break;
+  }
+  case BTEDB_SAMPLE_S16: {
+    const gint16* const s = (const gint16*)src;
+    for (guint i = 0; i < nsamples; ++i)
+      dst[i] = s[i * stride] * (1.0f / 32768);
+    break;
+  }
+  case BTEDB_SAMPLE_S32: {
+    const gint32* const s = (const gint32*)src;
+    for (guint i = 0; i < nsamples; ++i)
+      dst[i] = s[i * stride] * (1.0f / 2147483648.0f);
+    break;
+  }
+  }
+}
+
+void btedb_samples_from_float(BtEdbSampleFormat format, const gfloat* src, void* dst, guint stride, guint nsamples) {
+  switch (format) {
+  case BTEDB_SAMPLE_F32: {
+    gfloat* const d = (gfloat*)dst;
+    for (guint i = 0; i < nsamples; ++i)
+      d[i * stride] = src[i];
+    break;
+  }
+  case BTEDB_SAMPLE_F64: {
+    gdouble* const d = (gdouble*)dst;
+    for (guint i = 0; i < nsamples; ++i)
+      d[i * stride] = src[i];
+    break;
+  }
+  case BTEDB_SAMPLE_S16: {
+    gint16* const d = (gint16*)dst;
+    for (guint i = 0; i < nsamples; ++i)
+      d[i * stride] = lrintf(CLAMP(src[i] * 32768, -32768.0f, 32767.0f));
+    break;
+  }
+  case BTEDB_SAMPLE_S32: {
+    // Not every 32-bit integer is a float, so clipping is done in double precision.
+    gint32* const d = (gint32*)dst;
+    for (guint i = 0; i < nsamples; ++i)
+      d[i * stride] = lrint(CLAMP(src[i] * 2147483648.0, -2147483648.0, 2147483647.0));
+    break;
+  }
+  }
+}
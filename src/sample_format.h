@@ -0,0 +1,42 @@
+/*
+  Distort effect for Buzztrax
+  Copyright (C) 2020 David Beswick
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <glib.h>
+
+// The sample formats that can be processed without conversion by another element. All are native endian.
+typedef enum {
+  BTEDB_SAMPLE_F32,
+  BTEDB_SAMPLE_F64,
+  BTEDB_SAMPLE_S16,
+  BTEDB_SAMPLE_S32
+} BtEdbSampleFormat;
+
+guint btedb_sample_format_size(BtEdbSampleFormat format);
+
+/*
+  Converts "nsamples" samples to floats, where full scale is 1. Consecutive source samples are "stride" samples apart,
+  so a single channel can be read from interleaved audio.
+
+  Conversion is done in small blocks just before and after processing, so that the converted samples stay in cache.
+*/
+void btedb_samples_to_float(BtEdbSampleFormat format, const void* src, guint stride, gfloat* dst, guint nsamples);
+
+// The reverse of btedb_samples_to_float. Integer samples are rounded, and clipped at full scale.
+void btedb_samples_from_float(BtEdbSampleFormat format, const gfloat* src, void* dst, guint stride, guint nsamples);
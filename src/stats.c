@@ -0,0 +1,69 @@
+/*
+  Distort effect for Buzztrax
+  Copyright (C) 2020 David Beswick
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "config.h"
+#include "src/stats.h"
+
+#include <math.h>
+#include <string.h>
+
+void btedb_stats_reset(BtEdbStats* self) {
+  memset(self, 0, sizeof(*self));
+}
+
+static guint bucket(guint64 time) {
+  if (time == 0)
+    return 0;
+  const gint result = (gint)(log2((gdouble)time) * BTEDB_STATS_BUCKETS_PER_OCTAVE);
+  return CLAMP(result, 0, BTEDB_STATS_N_BUCKETS - 1);
+}
+
+static guint64 bucket_top(guint index) {
+  return (guint64)ceil(exp2((gdouble)(index + 1) / BTEDB_STATS_BUCKETS_PER_OCTAVE));
+}
+
+void btedb_stats_add(BtEdbStats* self, guint64 time, guint64 duration, guint64 nsamples) {
+  self->buffers++;
+  self->samples += nsamples;
+  self->process_time += time;
+  self->stream_time += duration;
+  self->max_process_time = MAX(self->max_process_time, time);
+  if (duration > 0)
+    self->max_load = MAX(self->max_load, (gdouble)time / duration);
+  self->histogram[bucket(time)]++;
+}
+
+guint64 btedb_stats_percentile(const BtEdbStats* self, gdouble fraction) {
+  if (self->buffers == 0)
+    return 0;
+
+  const guint64 target = (guint64)ceil(fraction * self->buffers);
+  guint64 count = 0;
+
+  for (guint i = 0; i < BTEDB_STATS_N_BUCKETS; ++i) {
+    count += self->histogram[i];
+    if (count >= target)
+      return MIN(bucket_top(i), self->max_process_time);
+  }
+
+  return self->max_process_time;
+}
+
+gdouble btedb_stats_load(const BtEdbStats* self) {
+  return self->stream_time > 0 ? (gdouble)self->process_time / self->stream_time : 0;
+}
@@ -0,0 +1,54 @@
+/*
+  Distort effect for Buzztrax
+  Copyright (C) 2020 David Beswick
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <glib.h>
+
+// Buckets per doubling of processing time. Percentiles are accurate to within a quarter octave, about 19%.
+#define BTEDB_STATS_BUCKETS_PER_OCTAVE 4
+// Enough octaves to cover processing times of up to 2^40 ns, about 18 minutes.
+#define BTEDB_STATS_N_BUCKETS (40 * BTEDB_STATS_BUCKETS_PER_OCTAVE)
+
+/*
+  Processing statistics for one element. Per-buffer processing times are kept as a histogram with logarithmically
+  spaced buckets, so that percentiles can be found without storing every time.
+
+  There's no locking here. The owner must guard a shared instance.
+*/
+typedef struct {
+  guint64 buffers;
+  guint64 samples;
+  // Totals, in nanoseconds.
+  guint64 process_time;
+  guint64 stream_time;
+  guint64 max_process_time;
+  gdouble max_load;
+  guint64 histogram[BTEDB_STATS_N_BUCKETS];
+} BtEdbStats;
+
+void btedb_stats_reset(BtEdbStats* self);
+
+// Records one buffer of "nsamples" samples, lasting "duration" ns, which took "time" ns to process.
+void btedb_stats_add(BtEdbStats* self, guint64 time, guint64 duration, guint64 nsamples);
+
+// The processing time that "fraction" of buffers took no longer than, in ns. The result is the top of a bucket.
+guint64 btedb_stats_percentile(const BtEdbStats* self, gdouble fraction);
+
+// The total processing time as a fraction of the total duration of the audio processed.
+gdouble btedb_stats_load(const BtEdbStats* self);
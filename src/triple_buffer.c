@@ -0,0 +1,60 @@
+/*
+  Distort effect for Buzztrax
+  Copyright (C) 2020 David Beswick
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "config.h"
+#include "src/triple_buffer.h"
+
+#define INDEX_MASK (BTEDB_TRIPLE_BUFFER_FRESH - 1)
+
+void btedb_triple_buffer_init(BtEdbTripleBuffer* self, gpointer slot0, gpointer slot1, gpointer slot2) {
+  self->slots[0] = slot0;
+  self->slots[1] = slot1;
+  self->slots[2] = slot2;
+  self->front = 0;
+  self->back = 1;
+  g_atomic_int_set(&self->middle, 2);
+}
+
+gpointer btedb_triple_buffer_back(BtEdbTripleBuffer* self) {
+  return self->slots[self->back];
+}
+
+// Puts "index" in the middle, and returns the index that was there.
+static gint exchange_middle(BtEdbTripleBuffer* self, gint index) {
+  gint old;
+  do {
+    old = g_atomic_int_get(&self->middle);
+  } while (!g_atomic_int_compare_and_exchange(&self->middle, old, index));
+  return old;
+}
+
+void btedb_triple_buffer_publish(BtEdbTripleBuffer* self) {
+  self->back = exchange_middle(self, self->back | BTEDB_TRIPLE_BUFFER_FRESH) & INDEX_MASK;
+}
+
+gpointer btedb_triple_buffer_read(BtEdbTripleBuffer* self, gboolean* fresh) {
+  const gboolean result = (g_atomic_int_get(&self->middle) & BTEDB_TRIPLE_BUFFER_FRESH) != 0;
+
+  if (result)
+    self->front = exchange_middle(self, self->front) & INDEX_MASK;
+
+  if (fresh)
+    *fresh = result;
+
+  return self->slots[self->front];
+}
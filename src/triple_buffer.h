@@ -0,0 +1,56 @@
+/*
+  Distort effect for Buzztrax
+  Copyright (C) 2020 David Beswick
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <glib.h>
+
+/*
+  Passes values from one writer thread to one reader thread without either having to wait for the other.
+
+  There are three slots. The writer fills its "back" slot and publishes it, which swaps it with the "middle" slot.
+  The reader swaps its "front" slot with the middle one whenever something new has been published there. So the
+  reader always has a complete value, which the writer won't touch until the reader has moved on to a newer one.
+
+  Only one thread may write at a time, and only one may read. The slots are owned by the caller.
+*/
+typedef struct {
+  gpointer slots[3];
+  // The index of the middle slot, with BTEDB_TRIPLE_BUFFER_FRESH set if it hasn't been read yet. Accessed atomically.
+  gint middle;
+  // Only used by the writer.
+  guint back;
+  // Only used by the reader.
+  guint front;
+} BtEdbTripleBuffer;
+
+#define BTEDB_TRIPLE_BUFFER_FRESH 4
+
+// Each slot should hold the same initial value, which the reader will see until something is published.
+void btedb_triple_buffer_init(BtEdbTripleBuffer* self, gpointer slot0, gpointer slot1, gpointer slot2);
+
+// The slot for the writer to fill.
+gpointer btedb_triple_buffer_back(BtEdbTripleBuffer* self);
+// Makes the back slot available to the reader, and gives the writer a new back slot.
+void btedb_triple_buffer_publish(BtEdbTripleBuffer* self);
+
+/*
+  Returns the most recently published value, which stays valid until the next call. "fresh" is set to whether it's
+  changed since the last call, and may be NULL.
+*/
+gpointer btedb_triple_buffer_read(BtEdbTripleBuffer* self, gboolean* fresh);
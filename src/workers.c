@@ -0,0 +1,111 @@
+/*
+  Distort effect for Buzztrax
+  Copyright (C) 2020 David Beswick
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "config.h"
+#include "src/workers.h"
+
+struct _BtEdbWorkers {
+  guint nthreads;
+  // NULL when there is only one thread, which is the caller's.
+  GThreadPool* pool;
+};
+
+/*
+  One call to btedb_workers_run. Threads take jobs until there are none left, so that a thread that's slow to wake
+  doesn't hold up the others.
+
+  The caller waits until every thread it woke has finished with the run, not just until the jobs are done, because the
+  run lives on the caller's stack.
+*/
+typedef struct {
+  BtEdbWorkFunc func;
+  gpointer user_data;
+  gint njobs;
+  gint next_job;
+  guint active_threads;
+  GMutex lock;
+  GCond done;
+} Run;
+
+static void run_jobs(Run* const run) {
+  gint job;
+  while ((job = g_atomic_int_add(&run->next_job, 1)) < run->njobs) {
+    run->func(run->user_data, job);
+  }
+}
+
+static void pool_func(gpointer data, gpointer user_data) {
+  Run* const run = (Run*)data;
+
+  run_jobs(run);
+
+  g_mutex_lock(&run->lock);
+  if (--run->active_threads == 0)
+    g_cond_signal(&run->done);
+  g_mutex_unlock(&run->lock);
+}
+
+BtEdbWorkers* btedb_workers_new(guint nthreads) {
+  BtEdbWorkers* const self = g_new0(BtEdbWorkers, 1);
+  self->nthreads = MAX(nthreads, 1);
+
+  // Exclusive threads are started now and kept, rather than shared with other pools or started on demand.
+  if (self->nthreads > 1)
+    self->pool = g_thread_pool_new(pool_func, NULL, self->nthreads - 1, TRUE, NULL);
+
+  return self;
+}
+
+void btedb_workers_free(BtEdbWorkers* self) {
+  if (self->pool)
+    g_thread_pool_free(self->pool, TRUE, TRUE);
+  g_free(self);
+}
+
+guint btedb_workers_get_threads(const BtEdbWorkers* self) {
+  return self->nthreads;
+}
+
+void btedb_workers_run(BtEdbWorkers* self, guint njobs, BtEdbWorkFunc func, gpointer user_data) {
+  const guint helpers = self->pool ? MIN(self->nthreads, njobs) - 1 : 0;
+
+  if (helpers == 0) {
+    for (guint i = 0; i < njobs; ++i) {
+      func(user_data, i);
+    }
+    return;
+  }
+
+  Run run = { func, user_data, njobs, 0, helpers };
+  g_mutex_init(&run.lock);
+  g_cond_init(&run.done);
+
+  for (guint i = 0; i < helpers; ++i) {
+    g_thread_pool_push(self->pool, &run, NULL);
+  }
+
+  run_jobs(&run);
+
+  g_mutex_lock(&run.lock);
+  while (run.active_threads > 0)
+    g_cond_wait(&run.done, &run.lock);
+  g_mutex_unlock(&run.lock);
+
+  g_mutex_clear(&run.lock);
+  g_cond_clear(&run.done);
+}
@@ -0,0 +1,43 @@
+/*
+  Distort effect for Buzztrax
+  Copyright (C) 2020 David Beswick
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <glib.h>
+
+typedef struct _BtEdbWorkers BtEdbWorkers;
+
+typedef void (*BtEdbWorkFunc)(gpointer user_data, guint index);
+
+/*
+  A fixed set of threads for splitting one piece of work into parts that run at the same time.
+
+  The threads are started when the workers are created and wait for work, so that no time is spent starting threads
+  while processing.
+*/
+BtEdbWorkers* btedb_workers_new(guint nthreads);
+void btedb_workers_free(BtEdbWorkers* self);
+
+// The number of threads that work is spread over, including the caller of btedb_workers_run.
+guint btedb_workers_get_threads(const BtEdbWorkers* self);
+
+/*
+  Calls "func" once for each index from 0 to njobs - 1, spread over the workers and the calling thread, and returns
+  once every call has finished. Only one thread may call this at a time.
+*/
+void btedb_workers_run(BtEdbWorkers* self, guint njobs, BtEdbWorkFunc func, gpointer user_data);
@@ -0,0 +1,611 @@
+/*
+  Distort effect for Buzztrax
+  Copyright (C) 2020 David Beswick
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/*
+  Renders audio files through the distortion offline, as fast as the CPU allows.
+
+  Settings are given with the element's property names, e.g. "pos-db-pregain=12 mode=adaa1". Each input file is
+  written to the output directory under the same name, in the same format and with the same length: the latency of
+  oversampling is removed, so rendered files line up with the originals.
+
+  Files are memory-mapped, and processed in parallel with one file per thread. A summary of the throughput is printed
+  at the end.
+
+  Usage: bt-edb-distort-render -o DIR [--raw FORMAT,RATE,CHANNELS] [property=value...] FILE...
+*/
+
+#include "config.h"
+#include "src/adaa.h"
+#include "src/curve_table.h"
+#include "src/denormals.h"
+#include "src/kernel.h"
+#include "src/oversampler.h"
+#include "src/polynomial.h"
+#include "src/sample_format.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+// Frames read from the input at a time.
+#define BLOCK_FRAMES 1024
+
+#define WAVE_FORMAT_PCM 1
+#define WAVE_FORMAT_IEEE_FLOAT 3
+#define WAVE_FORMAT_EXTENSIBLE 0xfffe
+
+typedef enum {
+  MODE_EXACT,
+  MODE_TABLE,
+  MODE_ADAA1,
+  MODE_ADAA2,
+  MODE_POLYNOMIAL
+} Mode;
+
+typedef struct {
+  BtEdbDistortParams params;
+  guint oversample;
+  gboolean low_latency;
+  Mode mode;
+  guint table_size;
+  BtEdbInterp table_interp;
+  guint threads;
+} Settings;
+
+typedef enum {
+  PROP_FLOAT,
+  PROP_UINT,
+  PROP_BOOLEAN,
+  PROP_ENUM
+} PropType;
+
+typedef struct {
+  const char* name;
+  PropType type;
+  gsize offset;
+  // The nicks of an enum's values, in order, ending with NULL.
+  const char* const* nicks;
+} Prop;
+
+static const char* const mode_nicks[] = { "exact", "table", "adaa1", "adaa2", "polynomial", NULL };
+static const char* const interp_nicks[] = { "linear", "cubic", NULL };
+static const char* const oversampler_nicks[] = { "audioresample", "internal", NULL };
+
+// The element's settings that make sense offline, with the same names. "oversampler" is accepted but ignored.
+static const Prop props[] = {
+  { "oversample", PROP_UINT, G_STRUCT_OFFSET(Settings, oversample) },
+  { "oversampler", PROP_ENUM, 0, oversampler_nicks },
+  { "low-latency", PROP_BOOLEAN, G_STRUCT_OFFSET(Settings, low_latency) },
+  { "pos-db-pregain", PROP_FLOAT, G_STRUCT_OFFSET(Settings, params.pos_db_pregain) },
+  { "pos-shape-a", PROP_FLOAT, G_STRUCT_OFFSET(Settings, params.pos_shape_a) },
+  { "pos-shape-b", PROP_FLOAT, G_STRUCT_OFFSET(Settings, params.pos_shape_b) },
+  { "pos-shape-exp", PROP_FLOAT, G_STRUCT_OFFSET(Settings, params.pos_shape_exp) },
+  { "symmetric", PROP_BOOLEAN, G_STRUCT_OFFSET(Settings, params.symmetric) },
+  { "neg-db-pregain", PROP_FLOAT, G_STRUCT_OFFSET(Settings, params.neg_db_pregain) },
+  { "neg-shape-a", PROP_FLOAT, G_STRUCT_OFFSET(Settings, params.neg_shape_a) },
+  { "neg-shape-b", PROP_FLOAT, G_STRUCT_OFFSET(Settings, params.neg_shape_b) },
+  { "neg-shape-exp", PROP_FLOAT, G_STRUCT_OFFSET(Settings, params.neg_shape_exp) },
+  { "db-postgain", PROP_FLOAT, G_STRUCT_OFFSET(Settings, params.db_postgain) },
+  { "mode", PROP_ENUM, G_STRUCT_OFFSET(Settings, mode), mode_nicks },
+  { "table-size", PROP_UINT, G_STRUCT_OFFSET(Settings, table_size) },
+  { "table-interp", PROP_ENUM, G_STRUCT_OFFSET(Settings, table_interp), interp_nicks },
+  // Here, the number of files rendered at once.
+  { "threads", PROP_UINT, G_STRUCT_OFFSET(Settings, threads) }
+};
+
+// The element's defaults.
+static const Settings default_settings = {
+  .params = { 20, 1, 1, 1, TRUE, 20, 1, 1, 1, 0 },
+  .oversample = 2,
+  .low_latency = FALSE,
+  .mode = MODE_EXACT,
+  .table_size = 4096,
+  .table_interp = BTEDB_INTERP_LINEAR,
+  .threads = 0
+};
+
+// Everything that's shared by the threads, and doesn't change once rendering starts.
+typedef struct {
+  Settings settings;
+  BtEdbDistortKernel kernel;
+  BtEdbGainRamp gains;
+  BtEdbCurveTable* table;
+  BtEdbAdaaTable* adaa_table;
+  BtEdbPolynomial* polynomial;
+  guint factor;
+  // Frames of output to drop at the start, to make up for the latency of oversampling.
+  guint delay;
+  const char* output_dir;
+  // The format of raw inputs. "raw_channels" is zero if inputs are WAV files.
+  BtEdbSampleFormat raw_format;
+  guint raw_rate;
+  guint raw_channels;
+} Renderer;
+
+// The layout of one input file's audio data.
+typedef struct {
+  BtEdbSampleFormat format;
+  guint rate;
+  guint channels;
+  gsize data_offset;
+  guint64 frames;
+} Layout;
+
+typedef struct {
+  const Renderer* renderer;
+  BtEdbAdaaState* adaa;
+} ChannelContext;
+
+// Totals over all files, guarded by totals_lock.
+static GMutex totals_lock;
+static guint64 total_frames;
+static guint64 total_samples;
+static gdouble total_seconds;
+static guint64 total_bytes;
+static guint failures;
+
+static gdouble now(void) {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+/*
+  Sets a property if "arg" is a known property's name, followed by "=" and the value. Anything else is taken to be a
+  file, so that paths containing "=" can still be rendered.
+ */
+static gboolean parse_property(Settings* settings, const char* arg) {
+  const char* const eq = strchr(arg, '=');
+  if (!eq)
+    return FALSE;
+
+  const gsize name_len = eq - arg;
+  const char* const value = eq + 1;
+
+  for (guint i = 0; i < G_N_ELEMENTS(props); ++i) {
+    const Prop* const prop = &props[i];
+    if (strlen(prop->name) != name_len || strncmp(prop->name, arg, name_len) != 0)
+      continue;
+
+    gpointer const field = (guint8*)settings + prop->offset;
+    char* end;
+
+    switch (prop->type) {
+    case PROP_FLOAT: {
+      const gdouble v = g_ascii_strtod(value, &end);
+      if (end == value || *end)
+        break;
+      *(gfloat*)field = v;
+      return TRUE;
+    }
+    case PROP_UINT: {
+      const guint64 v = g_ascii_strtoull(value, &end, 10);
+      if (end == value || *end || v > G_MAXUINT)
+        break;
+      *(guint*)field = v;
+      return TRUE;
+    }
+    case PROP_BOOLEAN:
+      if (!strcmp(value, "true") || !strcmp(value, "1")) {
+        *(gboolean*)field = TRUE;
+        return TRUE;
+      } else if (!strcmp(value, "false") || !strcmp(value, "0")) {
+        *(gboolean*)field = FALSE;
+        return TRUE;
+      }
+      break;
+    case PROP_ENUM:
+      for (guint v = 0; prop->nicks[v]; ++v) {
+        if (!strcmp(value, prop->nicks[v])) {
+          if (prop->offset)
+            *(guint*)field = v;
+          return TRUE;
+        }
+      }
+      break;
+    }
+
+    g_printerr("invalid value for %s: %s\n", prop->name, value);
+    exit(1);
+  }
+
+  return FALSE;
+}
+
+static gboolean parse_raw(Renderer* renderer, const char* arg) {
+  gchar** const parts = g_strsplit(arg, ",", 3);
+  gboolean ok = g_strv_length(parts) == 3;
+
+  if (ok) {
+    if (!strcmp(parts[0], "f32"))
+      renderer->raw_format = BTEDB_SAMPLE_F32;
+    else if (!strcmp(parts[0], "f64"))
+      renderer->raw_format = BTEDB_SAMPLE_F64;
+    else if (!strcmp(parts[0], "s16"))
+      renderer->raw_format = BTEDB_SAMPLE_S16;
+    else if (!strcmp(parts[0], "s32"))
+      renderer->raw_format = BTEDB_SAMPLE_S32;
+    else
+      ok = FALSE;
+
+    renderer->raw_rate = atoi(parts[1]);
+    renderer->raw_channels = atoi(parts[2]);
+    ok = ok && renderer->raw_rate > 0 && renderer->raw_channels > 0;
+  }
+
+  g_strfreev(parts);
+  return ok;
+}
+
+static guint16 read_u16(const guint8* p) {
+  return p[0] | (p[1] << 8);
+}
+
+static guint32 read_u32(const guint8* p) {
+  return p[0] | (p[1] << 8) | (p[2] << 16) | ((guint32)p[3] << 24);
+}
+
+/*
+  Finds the format and audio data of a WAV file. Only the formats that the element accepts are supported, and as
+  they're processed in place they must be native endian, which WAV always is on little endian machines.
+ */
+static gboolean wav_parse(const guint8* data, gsize size, Layout* layout, const char** error) {
+  if (G_BYTE_ORDER != G_LITTLE_ENDIAN) {
+    *error = "WAV files can only be rendered on little endian machines";
+    return FALSE;
+  }
+
+  if (size < 12 || memcmp(data, "RIFF", 4) || memcmp(data + 8, "WAVE", 4)) {
+    *error = "not a WAV file";
+    return FALSE;
+  }
+
+  gboolean have_fmt = FALSE;
+  guint16 tag = 0, bits = 0;
+
+  for (gsize pos = 12; pos + 8 <= size;) {
+    const guint8* const chunk = data + pos;
+    const guint32 len = read_u32(chunk + 4);
+
+    if (!memcmp(chunk, "fmt ", 4) && len >= 16 && pos + 8 + len <= size) {
+      tag = read_u16(chunk + 8);
+      layout->channels = read_u16(chunk + 10);
+      layout->rate = read_u32(chunk + 12);
+      bits = read_u16(chunk + 22);
+      // The real format tag is the start of the sub-format GUID.
+      if (tag == WAVE_FORMAT_EXTENSIBLE && len >= 26)
+        tag = read_u16(chunk + 32);
+      have_fmt = TRUE;
+    } else if (!memcmp(chunk, "data", 4)) {
+      if (!have_fmt) {
+        *error = "data chunk comes before fmt chunk";
+        return FALSE;
+      }
+
+      if (tag == WAVE_FORMAT_PCM && bits == 16)
+        layout->format = BTEDB_SAMPLE_S16;
+      else if (tag == WAVE_FORMAT_PCM && bits == 32)
+        layout->format = BTEDB_SAMPLE_S32;
+      else if (tag == WAVE_FORMAT_IEEE_FLOAT && bits == 32)
+        layout->format = BTEDB_SAMPLE_F32;
+      else if (tag == WAVE_FORMAT_IEEE_FLOAT && bits == 64)
+        layout->format = BTEDB_SAMPLE_F64;
+      else {
+        *error = "unsupported sample format; use 16 or 32-bit integer, or 32 or 64-bit float";
+        return FALSE;
+      }
+
+      if (layout->channels == 0) {
+        *error = "no channels";
+        return FALSE;
+      }
+
+      // Files that were cut short are rendered up to where they end.
+      layout->data_offset = pos + 8;
+      const gsize data_len = MIN(len, size - layout->data_offset);
+      layout->frames = data_len / (btedb_sample_format_size(layout->format) * layout->channels);
+      return TRUE;
+    }
+
+    // Chunks are padded to an even length.
+    pos += 8 + (gsize)len + (len & 1);
+  }
+
+  *error = "no data chunk";
+  return FALSE;
+}
+
+static void distort_channel(gpointer user_data, gfloat* data, guint nsamples) {
+  const ChannelContext* const context = (const ChannelContext*)user_data;
+  const Renderer* const renderer = context->renderer;
+
+  if (renderer->adaa_table)
+    btedb_adaa_process(
+      renderer->adaa_table, renderer->settings.mode == MODE_ADAA2 ? 2 : 1, context->adaa, data, 1, nsamples);
+  else if (renderer->polynomial)
+    btedb_polynomial_process(renderer->polynomial, data, nsamples);
+  else if (renderer->table)
+    btedb_curve_table_process(renderer->table, data, nsamples);
+  else
+    renderer->kernel(&renderer->settings.params, &renderer->gains, data, nsamples);
+}
+
+/*
+  Renders the audio from "in" to "out", which have the same layout. Input past the end is taken to be silence, so that
+  the delayed output can be flushed out.
+ */
+static void render_audio(const Renderer* renderer, const Layout* layout, const guint8* in, guint8* out) {
+  const guint channels = layout->channels;
+  const guint size = btedb_sample_format_size(layout->format);
+  const gsize frame_size = (gsize)size * channels;
+
+  BtEdbOversampler* const oversampler = renderer->factor > 1 ?
+    btedb_oversampler_new(
+      renderer->factor, channels,
+      renderer->settings.low_latency ? BTEDB_OVERSAMPLER_QUALITY_LOW_LATENCY : BTEDB_OVERSAMPLER_QUALITY_HIGH) :
+    NULL;
+  BtEdbAdaaState* const adaa = g_new0(BtEdbAdaaState, channels);
+  gfloat* const block = g_new(gfloat, BLOCK_FRAMES);
+
+  const guint64 end = layout->frames + renderer->delay;
+
+  for (guint64 pos = 0; pos < end; pos += BLOCK_FRAMES) {
+    const guint n = MIN(BLOCK_FRAMES, end - pos);
+    // The part of the block that comes from the input, and the part that goes to the output.
+    const guint n_in = pos < layout->frames ? MIN(n, layout->frames - pos) : 0;
+    const guint skip = pos < renderer->delay ? MIN(n, renderer->delay - pos) : 0;
+    const guint n_out = MIN(n - skip, layout->frames + renderer->delay - pos - skip);
+
+    for (guint c = 0; c < channels; ++c) {
+      ChannelContext context = { renderer, &adaa[c] };
+
+      btedb_samples_to_float(layout->format, in + pos * frame_size + c * size, channels, block, n_in);
+      memset(block + n_in, 0, (n - n_in) * sizeof(gfloat));
+
+      if (oversampler)
+        btedb_oversampler_process(oversampler, c, block, 1, n, distort_channel, &context);
+      else
+        distort_channel(&context, block, n);
+
+      if (n_out) {
+        btedb_samples_from_float(
+          layout->format, block + skip, out + (pos + skip - renderer->delay) * frame_size + c * size, channels, n_out);
+      }
+    }
+  }
+
+  g_free(block);
+  g_free(adaa);
+  if (oversampler)
+    btedb_oversampler_free(oversampler);
+}
+
+static gboolean render_file(const Renderer* renderer, const char* path, const char** error) {
+  gboolean result = FALSE;
+  int in_fd = -1, out_fd = -1;
+  guint8* in = MAP_FAILED;
+  guint8* out = MAP_FAILED;
+  struct stat st;
+
+  gchar* const basename = g_path_get_basename(path);
+  gchar* const out_path = g_build_filename(renderer->output_dir, basename, NULL);
+  g_free(basename);
+
+  in_fd = open(path, O_RDONLY);
+  if (in_fd < 0 || fstat(in_fd, &st) < 0) {
+    *error = g_strerror(errno);
+    goto done;
+  }
+
+  if (st.st_size == 0) {
+    *error = "empty file";
+    goto done;
+  }
+
+  in = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, in_fd, 0);
+  if (in == MAP_FAILED) {
+    *error = g_strerror(errno);
+    goto done;
+  }
+
+  Layout layout;
+  if (renderer->raw_channels) {
+    layout.format = renderer->raw_format;
+    layout.rate = renderer->raw_rate;
+    layout.channels = renderer->raw_channels;
+    layout.data_offset = 0;
+    layout.frames = st.st_size / (btedb_sample_format_size(layout.format) * layout.channels);
+  } else if (!wav_parse(in, st.st_size, &layout, error)) {
+    goto done;
+  }
+
+  // Rendering over the input would corrupt it while it's being read.
+  struct stat out_st;
+  if (stat(out_path, &out_st) == 0 && out_st.st_dev == st.st_dev && out_st.st_ino == st.st_ino) {
+    *error = "output would overwrite the input";
+    goto done;
+  }
+
+  out_fd = open(out_path, O_RDWR | O_CREAT | O_TRUNC, 0666);
+  if (out_fd < 0 || ftruncate(out_fd, st.st_size) < 0) {
+    *error = g_strerror(errno);
+    goto done;
+  }
+
+  out = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, out_fd, 0);
+  if (out == MAP_FAILED) {
+    *error = g_strerror(errno);
+    goto done;
+  }
+
+  // Everything but the audio is copied as it is, including any partial frame at the end.
+  memcpy(out, in, st.st_size);
+
+  madvise(in, st.st_size, MADV_SEQUENTIAL);
+  render_audio(renderer, &layout, in + layout.data_offset, out + layout.data_offset);
+
+  g_mutex_lock(&totals_lock);
+  total_frames += layout.frames;
+  total_samples += layout.frames * layout.channels;
+  total_seconds += (gdouble)layout.frames / layout.rate;
+  total_bytes += st.st_size;
+  g_mutex_unlock(&totals_lock);
+
+  result = TRUE;
+
+done:
+  if (out != MAP_FAILED)
+    munmap(out, st.st_size);
+  if (in != MAP_FAILED)
+    munmap(in, st.st_size);
+  if (out_fd >= 0)
+    close(out_fd);
+  if (in_fd >= 0)
+    close(in_fd);
+  g_free(out_path);
+
+  return result;
+}
+
+static void pool_func(gpointer data, gpointer user_data) {
+  const char* const path = (const char*)data;
+  const Renderer* const renderer = (const Renderer*)user_data;
+  const char* error = NULL;
+
+  const BtEdbFpMode fp_mode = btedb_denormals_disable();
+  const gboolean ok = render_file(renderer, path, &error);
+  btedb_denormals_restore(fp_mode);
+
+  if (!ok) {
+    g_printerr("%s: %s\n", path, error);
+    g_mutex_lock(&totals_lock);
+    failures++;
+    g_mutex_unlock(&totals_lock);
+  }
+}
+
+static void usage(void) {
+  g_printerr("usage: bt-edb-distort-render -o DIR [--raw FORMAT,RATE,CHANNELS] [property=value...] FILE...\n\n"
+             "FORMAT is one of f32, f64, s16 or s32, native endian and interleaved.\n"
+             "Properties are those of the element:\n");
+  for (guint i = 0; i < G_N_ELEMENTS(props); ++i) {
+    g_printerr("  %s\n", props[i].name);
+  }
+}
+
+int main(int argc, char** argv) {
+  Renderer renderer = { .settings = default_settings };
+  GPtrArray* const files = g_ptr_array_new();
+
+  for (int i = 1; i < argc; ++i) {
+    if (!strcmp(argv[i], "-o") && i + 1 < argc) {
+      renderer.output_dir = argv[++i];
+    } else if (!strcmp(argv[i], "--raw") && i + 1 < argc) {
+      if (!parse_raw(&renderer, argv[++i])) {
+        g_printerr("invalid raw format: %s\n", argv[i]);
+        return 1;
+      }
+    } else if (!strcmp(argv[i], "-h") || !strcmp(argv[i], "--help")) {
+      usage();
+      return 0;
+    } else if (!parse_property(&renderer.settings, argv[i])) {
+      g_ptr_array_add(files, argv[i]);
+    }
+  }
+
+  if (!renderer.output_dir || files->len == 0) {
+    usage();
+    return 1;
+  }
+
+  btedb_kernel_init();
+
+  const Settings* const settings = &renderer.settings;
+  renderer.kernel = btedb_kernel_select(&settings->params);
+  btedb_gain_ramp_init(&renderer.gains, &settings->params);
+  renderer.factor = btedb_oversampler_round_factor(MAX(settings->oversample, 1));
+
+  if (settings->mode == MODE_TABLE)
+    renderer.table = btedb_curve_table_new(&settings->params, MAX(settings->table_size, 16), settings->table_interp);
+  else if (settings->mode == MODE_ADAA1 || settings->mode == MODE_ADAA2)
+    renderer.adaa_table = btedb_adaa_table_new(&settings->params, MAX(settings->table_size, 16));
+  else if (settings->mode == MODE_POLYNOMIAL) {
+    /*
+      The fit decides the oversampling factor, as it does in the element. So does the element's choice of the exact
+      curve, at the "oversample" factor, when the fit isn't close enough.
+    */
+    renderer.polynomial = btedb_polynomial_new(&settings->params);
+    if (btedb_polynomial_is_accurate(renderer.polynomial)) {
+      renderer.factor = btedb_polynomial_get_oversample(renderer.polynomial);
+    } else {
+      btedb_polynomial_unref(renderer.polynomial);
+      renderer.polynomial = NULL;
+    }
+  }
+
+  // ADAA runs at the oversampled rate, so its delay is divided down.
+  gdouble latency = 0;
+  if (renderer.factor > 1) {
+    latency = btedb_oversampler_latency_for(
+      renderer.factor,
+      settings->low_latency ? BTEDB_OVERSAMPLER_QUALITY_LOW_LATENCY : BTEDB_OVERSAMPLER_QUALITY_HIGH);
+  }
+  if (renderer.adaa_table)
+    latency += btedb_adaa_latency(settings->mode == MODE_ADAA2 ? 2 : 1) / renderer.factor;
+  renderer.delay = (guint)(latency + 0.5);
+
+  const guint threads = settings->threads ? settings->threads : g_get_num_processors();
+  g_printerr("rendering %u files on %u threads with the %s kernel, %ux oversampling\n",
+             files->len, MIN(threads, files->len), btedb_kernel_name(), renderer.factor);
+
+  const gdouble start = now();
+
+  GThreadPool* const pool = g_thread_pool_new(pool_func, &renderer, MIN(threads, files->len), TRUE, NULL);
+  for (guint i = 0; i < files->len; ++i) {
+    g_thread_pool_push(pool, g_ptr_array_index(files, i), NULL);
+  }
+  // Waits for every file to finish.
+  g_thread_pool_free(pool, FALSE, TRUE);
+
+  const gdouble elapsed = now() - start;
+
+  printf("files\t%u\n", files->len - failures);
+  printf("failed\t%u\n", failures);
+  printf("audio_seconds\t%.3f\n", total_seconds);
+  printf("wall_seconds\t%.3f\n", elapsed);
+  printf("realtime\t%.1f\n", elapsed > 0 ? total_seconds / elapsed : 0);
+  printf("samples_per_sec\t%.0f\n", elapsed > 0 ? total_samples / elapsed : 0);
+  printf("mb_per_sec\t%.1f\n", elapsed > 0 ? total_bytes / elapsed / 1e6 : 0);
+
+  if (renderer.table)
+    btedb_curve_table_unref(renderer.table);
+  if (renderer.adaa_table)
+    btedb_adaa_table_unref(renderer.adaa_table);
+  if (renderer.polynomial)
+    btedb_polynomial_unref(renderer.polynomial);
+  g_ptr_array_free(files, TRUE);
+
+  return failures ? 1 : 0;
+}